@@ -0,0 +1,383 @@
+#pragma once
+
+#if !defined(__cpp_impl_coroutine)
+#error "AsyncSync.h needs C++20 coroutines; the pool itself builds as C++17"
+#endif
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+
+#include "ThreadPool.h"
+
+namespace MB {
+
+// Synchronization for coroutines running on a ThreadPool. A coroutine that
+// has to wait suspends instead of blocking its worker, and whoever releases
+// it resumes it by enqueueing it onto the pool (from a worker, onto that
+// worker's own queue). Uncontended operations are a single atomic
+// RMW with no lock.
+//
+//     MB::detached_task worker(MB::ThreadPool& pool, MB::async_mutex& mutex) {
+//         co_await MB::schedule_on(pool);
+//         MB::async_mutex_lock lock = co_await mutex.scoped_lock();
+//         ...
+//     }
+//
+// Waiters are resumed in arrival order, except async_latch and
+// async_barrier, which release everyone at once.
+
+namespace detail {
+
+inline void resumeOn(ThreadPool& pool, std::coroutine_handle<> handle) {
+    pool.enqueue([handle] { handle.resume(); });
+}
+
+} // namespace detail
+
+// Fire-and-forget coroutine: runs until its first suspension on the caller,
+// frees itself at the end. An escaping exception terminates, as from a task.
+struct detached_task {
+    struct promise_type {
+        detached_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// co_await schedule_on(pool) continues the coroutine on one of pool's workers
+inline auto schedule_on(ThreadPool& pool) {
+    struct Awaiter {
+        ThreadPool& pool;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { detail::resumeOn(pool, handle); }
+        void await_resume() const noexcept {}
+    };
+    return Awaiter{pool};
+}
+
+class async_mutex;
+
+// Unlocks on destruction; returned by co_await async_mutex::scoped_lock()
+class async_mutex_lock {
+public:
+    explicit async_mutex_lock(async_mutex& mutex) noexcept : mutex(&mutex) {}
+    async_mutex_lock(async_mutex_lock&& other) noexcept : mutex(other.mutex) { other.mutex = nullptr; }
+    async_mutex_lock(const async_mutex_lock&) = delete;
+    async_mutex_lock& operator=(const async_mutex_lock&) = delete;
+    inline ~async_mutex_lock();
+
+private:
+    async_mutex* mutex;
+};
+
+// The state word is kUnlocked, kLockedNoWaiters, or the newest waiter of a
+// lock-free stack that unlock() reverses into the FIFO `waiters` list,
+// which only the holder touches.
+class async_mutex {
+public:
+    class lock_operation {
+    public:
+        explicit lock_operation(async_mutex& mutex) noexcept : mutex(mutex) {}
+
+        bool await_ready() noexcept { return mutex.try_lock(); }
+
+        bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle = awaiting;
+            uintptr_t old = mutex.state.load(std::memory_order_acquire);
+            while (true) {
+                if (old == kUnlocked) {
+                    if (mutex.state.compare_exchange_weak(old, kLockedNoWaiters,
+                                                          std::memory_order_acquire,
+                                                          std::memory_order_acquire)) {
+                        return false; // Got it after all
+                    }
+                } else {
+                    next = old == kLockedNoWaiters ? nullptr : reinterpret_cast<lock_operation*>(old);
+                    if (mutex.state.compare_exchange_weak(old, reinterpret_cast<uintptr_t>(this),
+                                                          std::memory_order_release,
+                                                          std::memory_order_acquire)) {
+                        return true;
+                    }
+                }
+            }
+        }
+
+        void await_resume() const noexcept {}
+
+    protected:
+        friend class async_mutex;
+
+        async_mutex& mutex;
+        std::coroutine_handle<> handle;
+        lock_operation* next = nullptr;
+    };
+
+    class scoped_lock_operation : public lock_operation {
+    public:
+        using lock_operation::lock_operation;
+        async_mutex_lock await_resume() const noexcept { return async_mutex_lock(mutex); }
+    };
+
+    explicit async_mutex(ThreadPool& pool) noexcept : pool(pool) {}
+
+    async_mutex(const async_mutex&) = delete;
+    async_mutex& operator=(const async_mutex&) = delete;
+
+    bool try_lock() noexcept {
+        uintptr_t expected = kUnlocked;
+        return state.compare_exchange_strong(expected, kLockedNoWaiters, std::memory_order_acquire,
+                                             std::memory_order_relaxed);
+    }
+
+    // co_await lock(), then call unlock(); or hold the async_mutex_lock
+    // that co_await scoped_lock() returns
+    lock_operation lock() noexcept { return lock_operation(*this); }
+    scoped_lock_operation scoped_lock() noexcept { return scoped_lock_operation(*this); }
+
+    // Hands the lock straight to the longest waiting coroutine, if any
+    void unlock() {
+        lock_operation* head = waiters;
+        if (!head) {
+            uintptr_t old = kLockedNoWaiters;
+            if (state.compare_exchange_strong(old, kUnlocked, std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+                return;
+            }
+            // Take everyone who queued since, oldest first
+            old = state.exchange(kLockedNoWaiters, std::memory_order_acquire);
+            lock_operation* op = reinterpret_cast<lock_operation*>(old);
+            while (op) {
+                lock_operation* newer = op->next;
+                op->next = head;
+                head = op;
+                op = newer;
+            }
+        }
+        waiters = head->next;
+        detail::resumeOn(pool, head->handle);
+    }
+
+private:
+    static constexpr uintptr_t kUnlocked = 1;
+    static constexpr uintptr_t kLockedNoWaiters = 0;
+
+    std::atomic<uintptr_t> state{kUnlocked};
+    lock_operation* waiters = nullptr;
+    ThreadPool& pool;
+};
+
+inline async_mutex_lock::~async_mutex_lock() {
+    if (mutex) {
+        mutex->unlock();
+    }
+}
+
+// Counting semaphore. `value` is permits minus waiters, so acquire() and
+// release() only take the waiter lock when someone has to wait. A release
+// that beats its waiter to the queue leaves a wakeup behind for it.
+class async_semaphore {
+public:
+    class acquire_operation {
+    public:
+        explicit acquire_operation(async_semaphore& semaphore) noexcept : semaphore(semaphore) {}
+
+        bool await_ready() noexcept {
+            return semaphore.value.fetch_sub(1, std::memory_order_acq_rel) > 0;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::unique_lock<std::mutex> lock(semaphore.mutex);
+            if (semaphore.pendingWakeups > 0) {
+                --semaphore.pendingWakeups;
+                return false;
+            }
+            semaphore.waiters.push_back(handle);
+            return true;
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        async_semaphore& semaphore;
+    };
+
+    async_semaphore(ThreadPool& pool, std::ptrdiff_t permits) noexcept
+        : pool(pool), value(permits) {}
+
+    async_semaphore(const async_semaphore&) = delete;
+    async_semaphore& operator=(const async_semaphore&) = delete;
+
+    bool try_acquire() noexcept {
+        std::ptrdiff_t current = value.load(std::memory_order_relaxed);
+        while (current > 0) {
+            if (value.compare_exchange_weak(current, current - 1, std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    acquire_operation acquire() noexcept { return acquire_operation(*this); }
+
+    void release(std::ptrdiff_t permits = 1) {
+        for (std::ptrdiff_t i = 0; i < permits; ++i) {
+            if (value.fetch_add(1, std::memory_order_acq_rel) < 0) {
+                wakeOne();
+            }
+        }
+    }
+
+private:
+    void wakeOne() {
+        std::coroutine_handle<> handle;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (waiters.empty()) {
+                ++pendingWakeups; // The waiter hasn't queued itself yet
+                return;
+            }
+            handle = waiters.front();
+            waiters.pop_front();
+        }
+        detail::resumeOn(pool, handle);
+    }
+
+    ThreadPool& pool;
+    std::atomic<std::ptrdiff_t> value;
+    std::mutex mutex;
+    std::deque<std::coroutine_handle<>> waiters; // Guarded by mutex
+    size_t pendingWakeups = 0;                   // Guarded by mutex
+};
+
+// Waiters push themselves on a lock-free stack; the count_down() that
+// reaches zero swaps in a "released" marker and resumes them all.
+class async_latch {
+public:
+    class wait_operation {
+    public:
+        explicit wait_operation(async_latch& latch) noexcept : latch(latch) {}
+
+        bool await_ready() const noexcept { return latch.try_wait(); }
+
+        bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle = awaiting;
+            void* old = latch.waiters.load(std::memory_order_acquire);
+            do {
+                if (old == latch.released()) {
+                    return false;
+                }
+                next = static_cast<wait_operation*>(old);
+            } while (!latch.waiters.compare_exchange_weak(old, this, std::memory_order_release,
+                                                          std::memory_order_acquire));
+            return true;
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        friend class async_latch;
+
+        async_latch& latch;
+        std::coroutine_handle<> handle;
+        wait_operation* next = nullptr;
+    };
+
+    async_latch(ThreadPool& pool, std::ptrdiff_t expected) noexcept : pool(pool), count(expected) {
+        if (expected <= 0) {
+            waiters.store(released(), std::memory_order_relaxed);
+        }
+    }
+
+    async_latch(const async_latch&) = delete;
+    async_latch& operator=(const async_latch&) = delete;
+
+    void count_down(std::ptrdiff_t n = 1) {
+        if (count.fetch_sub(n, std::memory_order_acq_rel) != n) {
+            return;
+        }
+        void* old = waiters.exchange(released(), std::memory_order_acq_rel);
+        for (auto* op = static_cast<wait_operation*>(old); op;) {
+            wait_operation* next = op->next; // op may be gone once resumed
+            detail::resumeOn(pool, op->handle);
+            op = next;
+        }
+    }
+
+    bool try_wait() const noexcept { return count.load(std::memory_order_acquire) <= 0; }
+
+    wait_operation wait() noexcept { return wait_operation(*this); }
+
+private:
+    // Our own address can't be a waiter's
+    void* released() noexcept { return this; }
+
+    ThreadPool& pool;
+    std::atomic<std::ptrdiff_t> count;
+    std::atomic<void*> waiters{nullptr};
+};
+
+// Reusable barrier for a fixed number of participants. Each arrival pushes
+// itself on the waiter stack before counting down, so the last one to
+// arrive finds everyone; it resets the count, resumes the others and
+// carries on without suspending.
+class async_barrier {
+public:
+    class arrive_operation {
+    public:
+        explicit arrive_operation(async_barrier& barrier) noexcept : barrier(barrier) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> awaiting) {
+            handle = awaiting;
+            next = barrier.waiters.load(std::memory_order_relaxed);
+            while (!barrier.waiters.compare_exchange_weak(next, this, std::memory_order_release,
+                                                          std::memory_order_relaxed)) {
+            }
+            if (barrier.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return true; // Not last; may already be resumed, so hands off `this`
+            }
+            arrive_operation* op = barrier.waiters.exchange(nullptr, std::memory_order_acquire);
+            barrier.remaining.store(barrier.participants, std::memory_order_release);
+            while (op) {
+                arrive_operation* following = op->next;
+                if (op != this) {
+                    detail::resumeOn(barrier.pool, op->handle);
+                }
+                op = following;
+            }
+            return false;
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        async_barrier& barrier;
+        std::coroutine_handle<> handle;
+        arrive_operation* next = nullptr;
+    };
+
+    async_barrier(ThreadPool& pool, std::ptrdiff_t participants) noexcept
+        : pool(pool), participants(participants), remaining(participants) {}
+
+    async_barrier(const async_barrier&) = delete;
+    async_barrier& operator=(const async_barrier&) = delete;
+
+    arrive_operation arrive_and_wait() noexcept { return arrive_operation(*this); }
+
+private:
+    ThreadPool& pool;
+    const std::ptrdiff_t participants;
+    std::atomic<std::ptrdiff_t> remaining;
+    std::atomic<arrive_operation*> waiters{nullptr};
+};
+
+} // namespace MB
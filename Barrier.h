@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+namespace MB {
+
+// Sense-reversing spin barrier for a fixed set of threads, as handed to
+// ThreadPool::parallelRegion bodies. The last thread to arrive resets the
+// count and flips the sense; everyone else spins on the sense, so a phase
+// costs one shared RMW per thread and one cache-line broadcast. Waiters
+// fall back to yielding after a short spin, for when there are more
+// participants than cores.
+class Barrier {
+public:
+    explicit Barrier(size_t participants)
+        : remaining(participants), count(participants) {}
+
+    Barrier(const Barrier&) = delete;
+    Barrier& operator=(const Barrier&) = delete;
+
+    // Blocks until all participants have called wait() for this phase
+    void wait() {
+        // Can't flip before we arrive, so this is the current phase's sense
+        bool phase = sense.load(std::memory_order_acquire);
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            remaining.store(count, std::memory_order_relaxed);
+            sense.store(!phase, std::memory_order_release);
+            return;
+        }
+        for (unsigned spins = 0; sense.load(std::memory_order_acquire) == phase; ++spins) {
+            if (spins < kSpinLimit) {
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    size_t participants() const { return count; }
+
+private:
+    static constexpr unsigned kSpinLimit = 4096;
+
+    alignas(64) std::atomic<size_t> remaining;
+    alignas(64) std::atomic<bool> sense{false};
+    const size_t count;
+};
+
+} // namespace MB
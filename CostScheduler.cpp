@@ -0,0 +1,85 @@
+#include "CostScheduler.h"
+
+namespace MB {
+
+void CostScheduler::push(TaskTag tag, std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto& slot = tags[tag];
+    if (!slot) {
+        slot = std::make_unique<Tag>();
+        slot->id = tag;
+    }
+    Tag& t = *slot;
+    if (t.tasks.empty()) {
+        t.activeIndex = active.size();
+        active.push_back(&t);
+    }
+    t.tasks.push(Entry{std::move(task), Clock::now()});
+    queued.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool CostScheduler::tryPop(std::function<void()>& task, TaskTag& tag) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (active.empty()) {
+        return false;
+    }
+
+    Tag* oldest = active[0];
+    Tag* cheapest = active[0];
+    for (Tag* t : active) {
+        if (t->tasks.front().enqueued < oldest->tasks.front().enqueued) {
+            oldest = t;
+        }
+        if (t->expectedNs < cheapest->expectedNs ||
+            (t->expectedNs == cheapest->expectedNs &&
+             t->tasks.front().enqueued < cheapest->tasks.front().enqueued)) {
+            cheapest = t;
+        }
+    }
+    Tag* chosen = oldest;
+    if (shortestFirst && Clock::now() - oldest->tasks.front().enqueued < starvationLimit) {
+        chosen = cheapest;
+    }
+
+    task = std::move(chosen->tasks.front().task);
+    chosen->tasks.pop();
+    tag = chosen->id;
+    queued.fetch_sub(1, std::memory_order_relaxed);
+
+    if (chosen->tasks.empty()) {
+        Tag* last = active.back();
+        active[chosen->activeIndex] = last;
+        last->activeIndex = chosen->activeIndex;
+        active.pop_back();
+    }
+    return true;
+}
+
+void CostScheduler::record(TaskTag tag, std::chrono::nanoseconds elapsed) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = tags.find(tag);
+    if (it == tags.end()) {
+        return;
+    }
+    Tag& t = *it->second;
+    double sample = static_cast<double>(elapsed.count());
+    t.expectedNs = t.measured ? t.expectedNs + kAlpha * (sample - t.expectedNs) : sample;
+    t.measured = true;
+}
+
+void CostScheduler::setShortestFirst(bool enabled, std::chrono::nanoseconds limit) {
+    std::unique_lock<std::mutex> lock(mutex);
+    shortestFirst = enabled;
+    starvationLimit = limit;
+}
+
+std::chrono::nanoseconds CostScheduler::expectedCost(TaskTag tag) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = tags.find(tag);
+    if (it == tags.end()) {
+        return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::nanoseconds(static_cast<int64_t>(it->second->expectedNs));
+}
+
+} // namespace MB
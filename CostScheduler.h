@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace MB {
+
+using TaskTag = uint32_t;
+
+// Per-tag FIFO queues plus an EWMA of each tag's execution time. In FIFO
+// mode tagged tasks come out in submission order; in shortest-expected-
+// first mode the tag with the lowest expected cost goes first, unless some
+// task has waited past the starvation limit, in which case the oldest one
+// does. Tags without history count as free so they get measured quickly.
+class CostScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    CostScheduler() = default;
+    CostScheduler(const CostScheduler&) = delete;
+    CostScheduler& operator=(const CostScheduler&) = delete;
+
+    void push(TaskTag tag, std::function<void()> task);
+    bool tryPop(std::function<void()>& task, TaskTag& tag);
+    // Feed one measured execution into the tag's average
+    void record(TaskTag tag, std::chrono::nanoseconds elapsed);
+
+    void setShortestFirst(bool enabled, std::chrono::nanoseconds starvationLimit);
+    std::chrono::nanoseconds expectedCost(TaskTag tag) const;
+
+    bool hasQueued() const { return queued.load(std::memory_order_seq_cst) > 0; }
+    size_t queuedCount() const { return queued.load(std::memory_order_relaxed); }
+
+private:
+    // Weight of the newest sample in the moving average
+    static constexpr double kAlpha = 0.2;
+
+    struct Entry {
+        std::function<void()> task;
+        Clock::time_point enqueued;
+    };
+
+    struct Tag {
+        TaskTag id = 0;
+        std::queue<Entry> tasks;
+        double expectedNs = 0.0;
+        bool measured = false;
+        size_t activeIndex = 0; // Position in `active` while tasks is non-empty
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<TaskTag, std::unique_ptr<Tag>> tags;
+    std::vector<Tag*> active; // Tags with queued tasks
+    bool shortestFirst = false;
+    std::chrono::nanoseconds starvationLimit{0};
+    std::atomic<size_t> queued = 0;
+};
+
+} // namespace MB
@@ -0,0 +1,205 @@
+#include "Epoch.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace MB {
+namespace epoch {
+
+namespace {
+
+// Retirements (or quiescent points with something retired) between
+// reclamation attempts
+constexpr unsigned kBatch = 64;
+
+// A record's state is (epoch << 1) | 1 while its thread is pinned
+constexpr uint64_t kInactive = 0;
+
+struct alignas(64) Record {
+    std::atomic<uint64_t> state{kInactive};
+    std::atomic<bool> inUse{true};
+    Record* next = nullptr;
+};
+
+struct Retired {
+    void* node;
+    void (*deleter)(void*);
+    uint64_t epoch;
+};
+
+struct Domain {
+    std::atomic<uint64_t> global{1};
+    std::atomic<Record*> records{nullptr};
+    std::atomic<size_t> pending{0};
+
+    // Nodes left behind by threads that exited before they were safe
+    std::mutex orphanMutex;
+    std::vector<Retired> orphans;
+    std::atomic<bool> hasOrphans{false};
+};
+
+// Never destroyed: worker threads may still retire during static teardown
+Domain& domain() {
+    static Domain* instance = new Domain();
+    return *instance;
+}
+
+Record* acquireRecord() {
+    Domain& d = domain();
+    // Reuse the record of a thread that has exited
+    for (Record* r = d.records.load(std::memory_order_acquire); r; r = r->next) {
+        bool used = false;
+        if (!r->inUse.load(std::memory_order_relaxed) &&
+            r->inUse.compare_exchange_strong(used, true, std::memory_order_acquire)) {
+            return r;
+        }
+    }
+    Record* record = new Record();
+    Record* head = d.records.load(std::memory_order_relaxed);
+    do {
+        record->next = head;
+    } while (!d.records.compare_exchange_weak(head, record, std::memory_order_release,
+                                              std::memory_order_relaxed));
+    return record;
+}
+
+// Frees the oldest entries of `list` (it is in retire order) that were
+// retired at least two epochs before `now`
+void freeSafe(std::vector<Retired>& list, uint64_t now) {
+    size_t n = 0;
+    while (n < list.size() && list[n].epoch + 2 <= now) {
+        list[n].deleter(list[n].node);
+        ++n;
+    }
+    if (n > 0) {
+        list.erase(list.begin(), list.begin() + n);
+        domain().pending.fetch_sub(n, std::memory_order_relaxed);
+    }
+}
+
+// The epoch moves on once every pinned thread has seen the current one
+void tryAdvance() {
+    Domain& d = domain();
+    uint64_t e = d.global.load(std::memory_order_seq_cst);
+    for (Record* r = d.records.load(std::memory_order_acquire); r; r = r->next) {
+        uint64_t s = r->state.load(std::memory_order_seq_cst);
+        if ((s & 1) && (s >> 1) != e) {
+            return;
+        }
+    }
+    d.global.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst);
+}
+
+struct ThreadState {
+    Record* record = nullptr;
+    unsigned guards = 0;
+    bool online = false;
+    unsigned sinceCollect = 0;
+    std::vector<Retired> limbo;
+
+    void pin() {
+        if (!record) {
+            record = acquireRecord();
+        }
+        uint64_t state = (domain().global.load(std::memory_order_seq_cst) << 1) | 1;
+        if (record->state.load(std::memory_order_relaxed) != state) {
+            record->state.store(state, std::memory_order_seq_cst);
+        }
+    }
+
+    void unpin() {
+        record->state.store(kInactive, std::memory_order_release);
+    }
+
+    ~ThreadState() {
+        if (!record) {
+            return;
+        }
+        record->state.store(kInactive, std::memory_order_release);
+        collect();
+        if (!limbo.empty()) {
+            Domain& d = domain();
+            std::unique_lock<std::mutex> lock(d.orphanMutex);
+            d.orphans.insert(d.orphans.end(), limbo.begin(), limbo.end());
+            d.hasOrphans.store(true, std::memory_order_relaxed);
+        }
+        record->inUse.store(false, std::memory_order_release);
+    }
+};
+
+thread_local ThreadState local;
+
+} // namespace
+
+Guard::Guard() {
+    if (local.guards++ == 0 && !local.online) {
+        local.pin();
+    }
+}
+
+Guard::~Guard() {
+    if (--local.guards == 0 && !local.online) {
+        local.unpin();
+    }
+}
+
+void retire(void* node, void (*deleter)(void*)) {
+    Domain& d = domain();
+    local.limbo.push_back({node, deleter, d.global.load(std::memory_order_seq_cst)});
+    d.pending.fetch_add(1, std::memory_order_relaxed);
+    if (++local.sinceCollect >= kBatch) {
+        collect();
+    }
+}
+
+void online() {
+    if (local.online) {
+        return;
+    }
+    local.online = true;
+    if (local.guards == 0) {
+        local.pin();
+    }
+}
+
+void offline() {
+    if (!local.online) {
+        return;
+    }
+    local.online = false;
+    if (local.guards == 0) {
+        local.unpin();
+    }
+}
+
+void quiescent() {
+    if (!local.online || local.guards > 0) {
+        return;
+    }
+    local.pin(); // Catch up with the current epoch
+    if (!local.limbo.empty() && ++local.sinceCollect >= kBatch) {
+        collect();
+    }
+}
+
+void collect() {
+    Domain& d = domain();
+    local.sinceCollect = 0;
+    tryAdvance();
+    uint64_t now = d.global.load(std::memory_order_seq_cst);
+    freeSafe(local.limbo, now);
+
+    if (d.hasOrphans.load(std::memory_order_relaxed)) {
+        std::unique_lock<std::mutex> lock(d.orphanMutex);
+        freeSafe(d.orphans, now);
+        d.hasOrphans.store(!d.orphans.empty(), std::memory_order_relaxed);
+    }
+}
+
+size_t pendingCount() {
+    return domain().pending.load(std::memory_order_relaxed);
+}
+
+} // namespace epoch
+} // namespace MB
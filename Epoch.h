@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace MB {
+
+// Epoch-based reclamation for lock-free structures. A node unlinked from a
+// shared structure is retire()d instead of deleted; it is freed once every
+// thread that might still be reading it has moved on.
+//
+// A thread counts as reading while it holds a Guard, or while it is online
+// and hasn't reached its next quiescent point. The pool's workers are online
+// while they run tasks and pass a quiescent point between tasks, so task
+// code can traverse protected structures without a Guard. Other threads
+// need one. Retired nodes are freed in batches by the retiring thread.
+namespace epoch {
+
+// Pins the calling thread for the guard's lifetime. Guards nest.
+class Guard {
+public:
+    Guard();
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+};
+
+// Frees `node` with `deleter` once no thread can hold a reference to it.
+// The node must already be unreachable for new readers.
+void retire(void* node, void (*deleter)(void*));
+
+template <typename T>
+void retire(T* node) {
+    retire(static_cast<void*>(node), [](void* p) { delete static_cast<T*>(p); });
+}
+
+// Quiescent-state interface. An online thread blocks reclamation until it
+// calls quiescent(), which asserts it holds no references right now; call
+// offline() before blocking for long. A task that runs for a long time holds
+// back reclamation for everyone.
+void online();
+void offline();
+void quiescent();
+
+// Try to advance the epoch and free whatever the calling thread has
+// retired that is now safe. retire() and quiescent() do this periodically.
+void collect();
+
+// Retired nodes not yet freed, across all threads.
+size_t pendingCount();
+
+} // namespace epoch
+} // namespace MB
@@ -0,0 +1,101 @@
+#include "EventCount.h"
+
+#include <algorithm>
+#include <climits>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace MB {
+
+EventCount::Key EventCount::prepareWait() {
+    state.fetch_add(kOneWaiter, std::memory_order_seq_cst);
+    // Pairs with the fence in notify(): either the notifier sees us as a
+    // waiter, or we see its published state when re-checking the condition.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch.load(std::memory_order_acquire);
+}
+
+void EventCount::cancelWait() {
+    leave(false);
+}
+
+void EventCount::commitWait(Key key) {
+#if defined(__linux__)
+    while (epoch.load(std::memory_order_acquire) == key) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch), FUTEX_WAIT_PRIVATE,
+                key, nullptr, nullptr, 0);
+    }
+#else
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this, key] { return epoch.load(std::memory_order_acquire) != key; });
+    }
+#endif
+    leave(true);
+}
+
+void EventCount::leave(bool consumeSignal) {
+    uint64_t current = state.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        uint64_t waiters = (current >> kWaiterShift) - 1;
+        uint64_t signals = current & kSignalMask;
+        if (consumeSignal && signals > 0) {
+            --signals;
+        }
+        // A cancelling waiter is awake anyway; it absorbs a surplus signal
+        next = (waiters << kWaiterShift) | std::min(signals, waiters);
+    } while (!state.compare_exchange_weak(current, next, std::memory_order_relaxed));
+}
+
+void EventCount::notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t current = state.load(std::memory_order_relaxed);
+    do {
+        // Nobody parked, or everyone parked already has a wakeup on the
+        // way: no RMW, no syscall
+        if ((current & kSignalMask) >= (current >> kWaiterShift)) {
+            return;
+        }
+    } while (!state.compare_exchange_weak(current, current + 1, std::memory_order_relaxed));
+    wake(1);
+}
+
+void EventCount::notifyAll() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t current = state.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        uint64_t waiters = current >> kWaiterShift;
+        if ((current & kSignalMask) >= waiters) {
+            return;
+        }
+        next = (waiters << kWaiterShift) | waiters;
+    } while (!state.compare_exchange_weak(current, next, std::memory_order_relaxed));
+    wake(INT_MAX);
+}
+
+void EventCount::wake(int count) {
+    wakes.fetch_add(1, std::memory_order_relaxed);
+#if defined(__linux__)
+    epoch.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch), FUTEX_WAKE_PRIVATE,
+            count, nullptr, nullptr, 0);
+#else
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        epoch.fetch_add(1, std::memory_order_release);
+    }
+    if (count == 1) {
+        cv.notify_one();
+    } else {
+        cv.notify_all();
+    }
+#endif
+}
+
+} // namespace MB
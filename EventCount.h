@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#if !defined(__linux__)
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace MB {
+
+// Eventcount: a condition variable without the mutex. Waiters announce
+// themselves, re-check their condition and only then sleep; notifiers skip
+// the kernel entirely when nobody has announced. Waiting is two-phase:
+//
+//     auto key = ec.prepareWait();
+//     if (conditionHolds()) { ec.cancelWait(); } else { ec.commitWait(key); }
+//
+// A notify that lands between prepareWait and commitWait bumps the epoch,
+// so commitWait returns immediately instead of losing the wakeup. Notifiers
+// also count the wakeups they have already issued, so a burst of notify()
+// calls wakes each announced waiter once rather than once per call.
+// Uses futex on Linux and a mutex/condvar pair elsewhere.
+class EventCount {
+public:
+    using Key = uint32_t;
+
+    EventCount() = default;
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    Key prepareWait();
+    void cancelWait();
+    void commitWait(Key key);
+
+    // Callers publish their state change before notifying.
+    void notify();    // Wake one waiter, if any
+    void notifyAll(); // Wake every waiter
+
+    size_t waiterCount() const { return state.load(std::memory_order_relaxed) >> 32; }
+    // Number of notifications that actually had to wake someone
+    uint64_t wakeCount() const { return wakes.load(std::memory_order_relaxed); }
+
+private:
+    // state packs (waiters << 32) | signals: announced waiters and the
+    // wakeups already sent to them but not yet consumed.
+    static constexpr uint64_t kWaiterShift = 32;
+    static constexpr uint64_t kSignalMask = (uint64_t(1) << kWaiterShift) - 1;
+    static constexpr uint64_t kOneWaiter = uint64_t(1) << kWaiterShift;
+
+    void leave(bool consumeSignal);
+    void wake(int count);
+
+    std::atomic<uint64_t> state{0};
+    std::atomic<uint32_t> epoch{0}; // Futex word on Linux
+    std::atomic<uint64_t> wakes{0};
+#if !defined(__linux__)
+    std::mutex mutex;
+    std::condition_variable cv;
+#endif
+};
+
+} // namespace MB
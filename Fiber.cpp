@@ -0,0 +1,591 @@
+#include "Fiber.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <exception>
+#include <system_error>
+#include <thread>
+
+#if defined(_WIN32)
+#define MB_FIBER_WIN32 1
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif (defined(__x86_64__) || defined(__aarch64__)) && (defined(__ELF__) || defined(__APPLE__))
+#define MB_FIBER_ASM 1
+#else
+#define MB_FIBER_UCONTEXT 1
+#include <ucontext.h>
+#endif
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Context switch: save the callee-saved registers on the current stack,
+// store its stack pointer in *from, load `to` and pop the same frame there.
+//     void mb_fiber_switch(void** from, void* to);
+// A new fiber starts in mb_fiber_entry, which calls fn(arg) with the two
+// values makeContext() left in callee-saved registers.
+#if defined(MB_FIBER_ASM)
+#if defined(__APPLE__)
+#define MB_FIBER_SYMBOL(name) "_" #name
+#define MB_FIBER_DECLARE(name) ".globl _" #name "\n.private_extern _" #name "\n"
+#else
+#define MB_FIBER_SYMBOL(name) #name
+#define MB_FIBER_DECLARE(name) ".globl " #name "\n.hidden " #name "\n.type " #name ",%function\n"
+#endif
+
+#if defined(__x86_64__)
+asm(".text\n"
+    MB_FIBER_DECLARE(mb_fiber_switch)
+    ".p2align 4\n"
+    MB_FIBER_SYMBOL(mb_fiber_switch) ":\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $16, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $16, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    MB_FIBER_DECLARE(mb_fiber_entry)
+    ".p2align 4\n"
+    MB_FIBER_SYMBOL(mb_fiber_entry) ":\n"
+    "    movq %rbx, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n");
+#else
+asm(".text\n"
+    MB_FIBER_DECLARE(mb_fiber_switch)
+    ".p2align 2\n"
+    MB_FIBER_SYMBOL(mb_fiber_switch) ":\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    MB_FIBER_DECLARE(mb_fiber_entry)
+    ".p2align 2\n"
+    MB_FIBER_SYMBOL(mb_fiber_entry) ":\n"
+    "    mov x0, x19\n"
+    "    blr x20\n"
+    "    brk #0\n");
+#endif
+
+extern "C" void mb_fiber_switch(void** from, void* to);
+extern "C" void mb_fiber_entry();
+#endif
+
+namespace MB {
+
+namespace detail {
+
+#if defined(MB_FIBER_ASM)
+struct Context {
+    void* sp = nullptr;
+};
+#elif defined(MB_FIBER_UCONTEXT)
+struct Context {
+    ucontext_t uc;
+};
+#else
+struct Context {
+    void* fiber = nullptr;
+};
+#endif
+
+struct FiberState {
+    Context context;
+    void* stack = nullptr;
+    std::function<void()> fn;
+    FiberScheduler* scheduler = nullptr;
+};
+
+struct FiberRuntime {
+    static void resume(FiberState* fiber);
+    static void wake(FiberState* fiber);
+    static void requeue(FiberState* fiber);
+    static void sleep(FiberState* fiber, std::chrono::nanoseconds duration);
+    static void finish(FiberState* fiber);
+};
+
+} // namespace detail
+
+namespace {
+
+using detail::Context;
+using detail::FiberRuntime;
+using detail::FiberState;
+
+// Work a fiber leaves for its worker to do once it is off the fiber's
+// stack, such as publishing it to a waiter list
+struct AfterSwitch {
+    void (*fn)(void*) = nullptr;
+    void* arg = nullptr;
+};
+
+struct ThreadContext {
+    Context scheduler; // The worker's own stack while a fiber runs
+    FiberState* running = nullptr;
+    int64_t sliceDeadline = 0; // steady_clock ns
+    AfterSwitch afterSwitch;
+};
+
+// A fiber can move between threads at any suspension point, so the
+// compiler must not reuse a thread_local address across one: every access
+// goes through this opaque call.
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+ThreadContext& threadContext() {
+    static thread_local ThreadContext context;
+    ThreadContext* current = &context;
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : "+r"(current));
+#endif
+    return *current;
+}
+
+void fiberMain(void* arg) noexcept;
+
+int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+#if defined(MB_FIBER_ASM)
+void makeContext(Context& context, void* stack, size_t size, FiberState* fiber) {
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~uintptr_t(15);
+#if defined(__x86_64__)
+    // The frame mb_fiber_switch pops: MXCSR and x87 control word, r15..r12,
+    // rbx, rbp, return address. rsp ends 16-byte aligned before the call.
+    uintptr_t* frame = reinterpret_cast<uintptr_t*>(top - 88);
+    uint32_t* control = reinterpret_cast<uint32_t*>(frame);
+    control[0] = 0x1F80;        // MXCSR default
+    control[1] = 0x037F;        // x87 control word default
+    frame[2] = 0;               // r15
+    frame[3] = 0;               // r14
+    frame[4] = 0;               // r13
+    frame[5] = reinterpret_cast<uintptr_t>(&fiberMain); // r12
+    frame[6] = reinterpret_cast<uintptr_t>(fiber);      // rbx
+    frame[7] = 0;               // rbp, ends frame-pointer backtraces
+    frame[8] = reinterpret_cast<uintptr_t>(&mb_fiber_entry);
+#else
+    // x19..x28, x29, x30, d8..d15
+    uintptr_t* frame = reinterpret_cast<uintptr_t*>(top - 160);
+    for (size_t i = 0; i < 20; ++i) {
+        frame[i] = 0;
+    }
+    frame[0] = reinterpret_cast<uintptr_t>(fiber);      // x19
+    frame[1] = reinterpret_cast<uintptr_t>(&fiberMain); // x20
+    frame[11] = reinterpret_cast<uintptr_t>(&mb_fiber_entry); // x30
+#endif
+    context.sp = frame;
+}
+
+void switchContext(Context& from, Context& to) {
+    mb_fiber_switch(&from.sp, to.sp);
+}
+#elif defined(MB_FIBER_UCONTEXT)
+// makecontext() only passes ints
+void ucontextEntry(unsigned high, unsigned low) {
+    uintptr_t arg = (static_cast<uintptr_t>(high) << 16 << 16) | low;
+    fiberMain(reinterpret_cast<void*>(arg));
+}
+
+void makeContext(Context& context, void* stack, size_t size, FiberState* fiber) {
+    getcontext(&context.uc);
+    context.uc.uc_stack.ss_sp = stack;
+    context.uc.uc_stack.ss_size = size;
+    context.uc.uc_link = nullptr;
+    uintptr_t arg = reinterpret_cast<uintptr_t>(fiber);
+    makecontext(&context.uc, reinterpret_cast<void (*)()>(&ucontextEntry), 2,
+                static_cast<unsigned>(arg >> 16 >> 16), static_cast<unsigned>(arg));
+}
+
+void switchContext(Context& from, Context& to) {
+    swapcontext(&from.uc, &to.uc);
+}
+#else
+void WINAPI win32Entry(void* arg) {
+    fiberMain(arg);
+}
+
+void switchContext(Context&, Context& to) {
+    SwitchToFiber(to.fiber);
+}
+#endif
+
+// Called on a fiber: switch back to its worker, which runs then(arg) as
+// soon as it is off the fiber's stack.
+void suspend(void (*then)(void*), void* arg) {
+    ThreadContext& thread = threadContext();
+    FiberState* self = thread.running;
+    thread.afterSwitch = {then, arg};
+    switchContext(self->context, thread.scheduler);
+    // Resumed, possibly on another thread: `thread` is stale from here on
+}
+
+void fiberMain(void* arg) noexcept {
+    FiberState* self = static_cast<FiberState*>(arg);
+    self->fn();
+    self->fn = nullptr;
+    suspend([](void* fiber) { FiberRuntime::finish(static_cast<FiberState*>(fiber)); }, self);
+}
+
+FiberState* runningFiber() {
+    return threadContext().running;
+}
+
+void unlockMutex(void* mutex) {
+    static_cast<std::mutex*>(mutex)->unlock();
+}
+
+#if !defined(MB_FIBER_WIN32)
+size_t pageSize() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+size_t roundToPages(size_t bytes) {
+    return (bytes + pageSize() - 1) / pageSize() * pageSize();
+}
+#endif
+
+// Stacks kept for reuse per scheduler, so spawning doesn't map and unmap
+constexpr size_t kMaxCachedStacks = 1024;
+
+} // namespace
+
+namespace detail {
+
+void FiberRuntime::resume(FiberState* fiber) {
+    ThreadContext& thread = threadContext();
+#if defined(MB_FIBER_WIN32)
+    if (!thread.scheduler.fiber) {
+        thread.scheduler.fiber = ConvertThreadToFiber(nullptr);
+        if (!thread.scheduler.fiber) {
+            thread.scheduler.fiber = GetCurrentFiber(); // Already a fiber
+        }
+    }
+#endif
+    thread.running = fiber;
+    thread.sliceDeadline = steadyNowNs() + fiber->scheduler->options.timeSlice.count();
+    switchContext(thread.scheduler, fiber->context);
+    thread.running = nullptr;
+
+    // The fiber is off its stack now; only from here may others resume it
+    AfterSwitch then = thread.afterSwitch;
+    thread.afterSwitch = {};
+    then.fn(then.arg);
+}
+
+void FiberRuntime::wake(FiberState* fiber) {
+    // From a worker this stays on that worker's own queue
+    fiber->scheduler->pool.enqueue([fiber] { resume(fiber); });
+}
+
+void FiberRuntime::requeue(FiberState* fiber) {
+    // enqueueBulk always goes through the shared queue, behind everything
+    // already waiting, where enqueue() from a worker could run it next
+    std::vector<std::function<void()>> batch;
+    batch.push_back([fiber] { resume(fiber); });
+    fiber->scheduler->pool.enqueueBulk(std::move(batch));
+}
+
+void FiberRuntime::sleep(FiberState* fiber, std::chrono::nanoseconds duration) {
+    fiber->scheduler->pool.enqueueAfter(duration, [fiber] { resume(fiber); });
+}
+
+void FiberRuntime::finish(FiberState* fiber) {
+    FiberScheduler* scheduler = fiber->scheduler;
+#if defined(MB_FIBER_WIN32)
+    DeleteFiber(fiber->context.fiber);
+#else
+    scheduler->releaseStack(fiber->stack);
+#endif
+    delete fiber;
+    scheduler->finished();
+}
+
+} // namespace detail
+
+FiberScheduler::FiberScheduler(ThreadPool& pool, FiberOptions options)
+    : pool(pool), options(options) {}
+
+FiberScheduler::~FiberScheduler() {
+    wait();
+#if !defined(MB_FIBER_WIN32)
+    size_t guard = options.guardPage ? pageSize() : 0;
+    size_t mapped = roundToPages(options.stackSize) + guard;
+    for (void* stack : freeStacks) {
+        munmap(static_cast<char*>(stack) - guard, mapped);
+    }
+#endif
+}
+
+void FiberScheduler::spawn(std::function<void()> fn) {
+    auto* fiber = new FiberState;
+    fiber->scheduler = this;
+    fiber->fn = std::move(fn);
+#if defined(MB_FIBER_WIN32)
+    fiber->context.fiber = CreateFiber(options.stackSize, &win32Entry, fiber);
+    if (!fiber->context.fiber) {
+        delete fiber;
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(),
+                                "CreateFiber");
+    }
+#else
+    fiber->stack = takeStack();
+    size_t usable = roundToPages(options.stackSize);
+    makeContext(fiber->context, fiber->stack, usable, fiber);
+#endif
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ++live;
+    }
+    pool.enqueue([fiber] { FiberRuntime::resume(fiber); });
+}
+
+void* FiberScheduler::takeStack() {
+#if defined(MB_FIBER_WIN32)
+    return nullptr;
+#else
+    {
+        std::unique_lock<std::mutex> lock(stacksMutex);
+        if (!freeStacks.empty()) {
+            void* stack = freeStacks.back();
+            freeStacks.pop_back();
+            return stack;
+        }
+    }
+    size_t guard = options.guardPage ? pageSize() : 0;
+    size_t usable = roundToPages(options.stackSize);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_NORESERVE)
+    flags |= MAP_NORESERVE;
+#endif
+    void* mapped = mmap(nullptr, usable + guard, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "mmap fiber stack");
+    }
+    // Stacks grow down, so the guard goes at the low end
+    if (guard && mprotect(mapped, guard, PROT_NONE) != 0) {
+        int err = errno;
+        munmap(mapped, usable + guard);
+        throw std::system_error(err, std::generic_category(), "mprotect fiber stack guard");
+    }
+    return static_cast<char*>(mapped) + guard;
+#endif
+}
+
+void FiberScheduler::releaseStack(void* stack) {
+#if !defined(MB_FIBER_WIN32)
+    {
+        std::unique_lock<std::mutex> lock(stacksMutex);
+        if (freeStacks.size() < kMaxCachedStacks) {
+            freeStacks.push_back(stack);
+            return;
+        }
+    }
+    size_t guard = options.guardPage ? pageSize() : 0;
+    size_t usable = roundToPages(options.stackSize);
+    munmap(static_cast<char*>(stack) - guard, usable + guard);
+#else
+    (void)stack;
+#endif
+}
+
+void FiberScheduler::finished() {
+    // Under the lock, so wait() can't return while we still touch *this
+    std::unique_lock<std::mutex> lock(mutex);
+    if (--live == 0) {
+        idle.notify_all();
+    }
+}
+
+void FiberScheduler::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return live == 0; });
+}
+
+size_t FiberScheduler::getLiveFiberCount() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return live;
+}
+
+namespace this_fiber {
+
+bool active() {
+    return runningFiber() != nullptr;
+}
+
+void yield() {
+    FiberState* self = runningFiber();
+    if (!self) {
+        std::this_thread::yield();
+        return;
+    }
+    suspend([](void* fiber) { FiberRuntime::requeue(static_cast<FiberState*>(fiber)); }, self);
+}
+
+void sleep_for(std::chrono::nanoseconds duration) {
+    FiberState* self = runningFiber();
+    if (!self) {
+        std::this_thread::sleep_for(duration);
+        return;
+    }
+    struct Sleep {
+        FiberState* fiber;
+        std::chrono::nanoseconds duration;
+    } request{self, duration};
+    suspend([](void* arg) {
+        Sleep* request = static_cast<Sleep*>(arg);
+        FiberRuntime::sleep(request->fiber, request->duration);
+    }, &request);
+}
+
+} // namespace this_fiber
+
+namespace this_task {
+
+bool yield_if_needed() {
+    ThreadContext& thread = threadContext();
+    if (!thread.running || steadyNowNs() < thread.sliceDeadline) {
+        return false;
+    }
+    this_fiber::yield();
+    return true;
+}
+
+} // namespace this_task
+
+bool FiberMutex::try_lock() {
+    bool expected = false;
+    return locked.compare_exchange_strong(expected, true, std::memory_order_acquire,
+                                          std::memory_order_relaxed);
+}
+
+void FiberMutex::lock() {
+    if (try_lock()) {
+        return;
+    }
+    FiberState* self = runningFiber();
+    if (!self) {
+        while (!try_lock()) {
+            std::this_thread::yield();
+        }
+        return;
+    }
+    guard.lock();
+    if (try_lock()) {
+        guard.unlock();
+        return;
+    }
+    waiters.push_back(self);
+    // The guard stays held until we are off this stack, so unlock() can't
+    // wake us before we have suspended
+    suspend(&unlockMutex, &guard);
+    // unlock() handed the lock over without clearing `locked`
+}
+
+void FiberMutex::unlock() {
+    std::unique_lock<std::mutex> lock(guard);
+    if (waiters.empty()) {
+        locked.store(false, std::memory_order_release);
+        return;
+    }
+    FiberState* next = waiters.front();
+    waiters.pop_front();
+    lock.unlock();
+    FiberRuntime::wake(next);
+}
+
+void FiberConditionVariable::wait(std::unique_lock<FiberMutex>& lock) {
+    FiberState* self = runningFiber();
+    if (!self) {
+        lock.unlock();
+        std::this_thread::yield();
+        lock.lock();
+        return;
+    }
+    struct Release {
+        std::mutex* guard;
+        FiberMutex* mutex;
+    } release{&guard, lock.mutex()};
+
+    guard.lock();
+    waiters.push_back(self);
+    suspend([](void* arg) {
+        // Copy first: once the guard is released we may be resumed and
+        // this frame reused
+        Release release = *static_cast<Release*>(arg);
+        release.mutex->unlock();
+        release.guard->unlock();
+    }, &release);
+    lock.mutex()->lock();
+}
+
+void FiberConditionVariable::notify_one() {
+    std::unique_lock<std::mutex> lock(guard);
+    if (waiters.empty()) {
+        return;
+    }
+    FiberState* next = waiters.front();
+    waiters.pop_front();
+    lock.unlock();
+    FiberRuntime::wake(next);
+}
+
+void FiberConditionVariable::notify_all() {
+    std::deque<FiberState*> woken;
+    {
+        std::unique_lock<std::mutex> lock(guard);
+        woken.swap(waiters);
+    }
+    for (FiberState* fiber : woken) {
+        FiberRuntime::wake(fiber);
+    }
+}
+
+} // namespace MB
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "ThreadPool.h"
+
+namespace MB {
+
+namespace detail {
+struct FiberState;
+struct FiberRuntime;
+} // namespace detail
+
+struct FiberOptions {
+    // Stacks are mapped lazily, so a fiber only costs the pages it touches
+    size_t stackSize = 64 * 1024;
+    // An inaccessible page below each stack, so a fiber that overflows its
+    // stack dies with SIGSEGV instead of silently overwriting the
+    // neighbouring stack. The guard splits each stack into two kernel
+    // mappings, and vm.max_map_count (65530 by default) caps those, so
+    // schedulers holding more than about 30k fibers at once must turn it
+    // off and size stackSize with care.
+    bool guardPage = true;
+    // How long a fiber runs before this_task::yield_if_needed() hands its
+    // worker to the next task
+    std::chrono::nanoseconds timeSlice = std::chrono::milliseconds(2);
+};
+
+// Stackful fibers multiplexed onto a ThreadPool's workers (M:N). A fiber
+// runs as an ordinary pool task until it blocks on a FiberMutex or
+// FiberConditionVariable, sleeps, or yields; it then hands the worker back
+// and is queued again once it can go on, possibly on another worker.
+//
+//     MB::FiberScheduler fibers(pool);
+//     fibers.spawn([&] {
+//         std::unique_lock<MB::FiberMutex> lock(mutex);
+//         ready.wait(lock, [&] { return done; });
+//     });
+//     fibers.wait();
+//
+// Fiber code must not hold a std::mutex or another thread-bound lock across
+// a suspension point, and must not expect thread_local values to survive
+// one. Context switches are hand-written for x86-64 and AArch64, with
+// ucontext (POSIX) and Win32 fibers as fallbacks.
+class FiberScheduler {
+public:
+    explicit FiberScheduler(ThreadPool& pool, FiberOptions options = {});
+    // Waits for every fiber spawned here
+    ~FiberScheduler();
+
+    FiberScheduler(const FiberScheduler&) = delete;
+    FiberScheduler& operator=(const FiberScheduler&) = delete;
+
+    // Thread-safe, and callable from fibers. fn must not throw.
+    void spawn(std::function<void()> fn);
+
+    // Blocks until every spawned fiber has finished. Not from a fiber.
+    void wait();
+
+    // Spawned and not yet finished, running or suspended
+    size_t getLiveFiberCount() const;
+
+private:
+    friend struct detail::FiberRuntime;
+
+    void* takeStack();
+    void releaseStack(void* stack);
+    void finished();
+
+    ThreadPool& pool;
+    const FiberOptions options;
+
+    std::mutex stacksMutex;
+    std::vector<void*> freeStacks; // Cached for reuse, guarded by stacksMutex
+
+    mutable std::mutex mutex;
+    std::condition_variable idle;
+    size_t live = 0; // Guarded by mutex
+};
+
+namespace this_fiber {
+
+// True when called on a fiber
+bool active();
+
+// Queue the current fiber behind the work already waiting and let the
+// worker run something else. Off a fiber these fall back to
+// std::this_thread.
+void yield();
+void sleep_for(std::chrono::nanoseconds duration);
+
+} // namespace this_fiber
+
+namespace this_task {
+
+// Cooperative time slicing for long computations; call it every few
+// microseconds of work. Once the current fiber has used up its time slice
+// it yields, so the rest of the task runs as a continuation behind the
+// work already waiting, and returns true. Costs a clock read on a fiber
+// and nothing off one, where it returns false.
+bool yield_if_needed();
+
+} // namespace this_task
+
+// Mutex that suspends a waiting fiber instead of blocking its worker.
+// unlock() hands the lock straight to the longest waiting fiber. Off a
+// fiber, lock() spins with std::this_thread::yield().
+class FiberMutex {
+public:
+    FiberMutex() = default;
+    FiberMutex(const FiberMutex&) = delete;
+    FiberMutex& operator=(const FiberMutex&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+private:
+    std::atomic<bool> locked = false;
+    std::mutex guard; // Held only for the waiter list
+    std::deque<detail::FiberState*> waiters;
+};
+
+// Condition variable for FiberMutex. Off a fiber, wait() unlocks, yields the
+// thread and relocks, which callers see as a spurious wakeup.
+class FiberConditionVariable {
+public:
+    FiberConditionVariable() = default;
+    FiberConditionVariable(const FiberConditionVariable&) = delete;
+    FiberConditionVariable& operator=(const FiberConditionVariable&) = delete;
+
+    void wait(std::unique_lock<FiberMutex>& lock);
+
+    template <typename Predicate>
+    void wait(std::unique_lock<FiberMutex>& lock, Predicate ready) {
+        while (!ready()) {
+            wait(lock);
+        }
+    }
+
+    void notify_one();
+    void notify_all();
+
+private:
+    std::mutex guard;
+    std::deque<detail::FiberState*> waiters;
+};
+
+} // namespace MB
@@ -0,0 +1,215 @@
+#include "FlatCombiningQueue.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+namespace MB {
+
+namespace {
+
+std::atomic<uint64_t> nextQueueId{1};
+
+// Ids of the queues not yet destroyed, so an exiting thread only hands back
+// records that still exist. Only touched when a thread takes a new record,
+// exits, or a queue comes or goes.
+struct LiveQueues {
+    std::mutex mutex;
+    std::unordered_set<uint64_t> ids;
+};
+
+// Never destroyed: threads may exit during static teardown
+LiveQueues& liveQueues() {
+    static LiveQueues* instance = new LiveQueues();
+    return *instance;
+}
+
+// Passes over the records per combining session: later passes pick up
+// operations published while the first pass was running
+constexpr int kCombinePasses = 3;
+
+} // namespace
+
+FlatCombiningQueue::FlatCombiningQueue()
+    : id(nextQueueId.fetch_add(1, std::memory_order_relaxed)) {
+    LiveQueues& live = liveQueues();
+    std::unique_lock<std::mutex> lock(live.mutex);
+    live.ids.insert(id);
+}
+
+FlatCombiningQueue::~FlatCombiningQueue() {
+    {
+        LiveQueues& live = liveQueues();
+        std::unique_lock<std::mutex> lock(live.mutex);
+        live.ids.erase(id);
+    }
+    Record* record = records.load(std::memory_order_acquire);
+    while (record) {
+        Record* next = record->next;
+        delete record;
+        record = next;
+    }
+}
+
+FlatCombiningQueue::Record* FlatCombiningQueue::myRecord() {
+    struct CacheEntry {
+        uint64_t queue;
+        Record* record;
+    };
+    // Hands this thread's records back when it exits, so short-lived
+    // submitting threads don't grow a queue's record list without bound
+    struct ThreadCache {
+        CacheEntry last{0, nullptr};
+        std::vector<CacheEntry> seen;
+
+        ~ThreadCache() {
+            LiveQueues& live = liveQueues();
+            std::unique_lock<std::mutex> lock(live.mutex);
+            if (last.record && live.ids.count(last.queue)) {
+                last.record->inUse.store(false, std::memory_order_release);
+            }
+            for (CacheEntry& entry : seen) {
+                if (live.ids.count(entry.queue)) {
+                    entry.record->inUse.store(false, std::memory_order_release);
+                }
+            }
+        }
+    };
+    thread_local ThreadCache cache;
+
+    if (cache.last.queue == id) {
+        return cache.last.record;
+    }
+    for (CacheEntry& entry : cache.seen) {
+        if (entry.queue == id) {
+            std::swap(entry, cache.last);
+            return cache.last.record;
+        }
+    }
+
+    // Reuse the record of a thread that has exited
+    Record* record = nullptr;
+    for (Record* r = records.load(std::memory_order_acquire); r; r = r->next) {
+        bool used = false;
+        if (!r->inUse.load(std::memory_order_relaxed) &&
+            r->inUse.compare_exchange_strong(used, true, std::memory_order_acquire)) {
+            record = r;
+            break;
+        }
+    }
+    if (!record) {
+        record = new Record();
+        Record* head = records.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!records.compare_exchange_weak(head, record, std::memory_order_release,
+                                                std::memory_order_relaxed));
+    }
+
+    if (cache.last.record) {
+        cache.seen.push_back(cache.last);
+    }
+    cache.last = CacheEntry{id, record};
+    {
+        // Forget queues destroyed since; their ids are never reused
+        LiveQueues& live = liveQueues();
+        std::unique_lock<std::mutex> lock(live.mutex);
+        cache.seen.erase(std::remove_if(cache.seen.begin(), cache.seen.end(),
+                                        [&live](const CacheEntry& entry) {
+                                            return live.ids.count(entry.queue) == 0;
+                                        }),
+                         cache.seen.end());
+    }
+    return record;
+}
+
+void FlatCombiningQueue::push(Task task) {
+    Record* record = myRecord();
+    record->task = std::move(task);
+    publish(record, Push);
+}
+
+void FlatCombiningQueue::pushBulk(std::vector<Task>& batch) {
+    Record* record = myRecord();
+    record->batch = &batch;
+    publish(record, PushBulk);
+}
+
+size_t FlatCombiningQueue::popBatch(std::vector<Task>& out, size_t maxTasks) {
+    if (size() == 0) {
+        return 0;
+    }
+    Record* record = myRecord();
+    record->batch = &out;
+    record->maxTasks = maxTasks;
+    publish(record, Pop);
+    return record->result;
+}
+
+void FlatCombiningQueue::publish(Record* record, Op op) {
+    record->op.store(op, std::memory_order_release);
+
+    unsigned spins = 0;
+    while (true) {
+        if (!combining.load(std::memory_order_relaxed) &&
+            !combining.exchange(true, std::memory_order_acquire)) {
+            combine();
+            combining.store(false, std::memory_order_release);
+        }
+        if (record->op.load(std::memory_order_acquire) == None) {
+            return;
+        }
+        // Someone else is combining; our request is probably in its pass
+        if (++spins > 64) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void FlatCombiningQueue::combine() {
+    for (int pass = 0; pass < kCombinePasses; ++pass) {
+        bool applied = false;
+        for (Record* r = records.load(std::memory_order_acquire); r; r = r->next) {
+            if (r->op.load(std::memory_order_acquire) != None) {
+                apply(*r);
+                applied = true;
+            }
+        }
+        if (!applied) {
+            break;
+        }
+    }
+}
+
+void FlatCombiningQueue::apply(Record& record) {
+    switch (record.op.load(std::memory_order_relaxed)) {
+    case Push:
+        tasks.push_back(std::move(record.task));
+        record.task = nullptr;
+        break;
+    case PushBulk:
+        for (Task& task : *record.batch) {
+            tasks.push_back(std::move(task));
+        }
+        break;
+    case Pop: {
+        size_t n = 0;
+        for (; n < record.maxTasks && !tasks.empty(); ++n) {
+            record.batch->push_back(std::move(tasks.front()));
+            tasks.pop_front();
+        }
+        record.result = n;
+        break;
+    }
+    default:
+        break;
+    }
+    // Size must be current before the requester sees its operation done:
+    // a producer notifies idle workers right after push() returns
+    count.store(tasks.size(), std::memory_order_relaxed);
+    record.op.store(None, std::memory_order_release);
+}
+
+} // namespace MB
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+
+#include "TaskQueue.h"
+
+namespace MB {
+
+// Flat-combining FIFO (Hendler, Incze, Shavit, Tzafrir). Each thread
+// publishes its operation in a per-thread record; whichever thread takes
+// the combiner lock applies every published operation to a plain deque in
+// one pass while the others spin on their own record. Under heavy
+// contention the queue's cache lines stay with the combiner instead of
+// bouncing between producers.
+class FlatCombiningQueue : public TaskQueue {
+public:
+    FlatCombiningQueue();
+    ~FlatCombiningQueue() override;
+
+    FlatCombiningQueue(const FlatCombiningQueue&) = delete;
+    FlatCombiningQueue& operator=(const FlatCombiningQueue&) = delete;
+
+    void push(Task task) override;
+    void pushBulk(std::vector<Task>& batch) override;
+    size_t popBatch(std::vector<Task>& out, size_t maxTasks) override;
+    size_t size() const override { return count.load(std::memory_order_seq_cst); }
+
+private:
+    enum Op : int { None, Push, PushBulk, Pop };
+
+    // One per (thread, queue) while the thread lives; freed for reuse by
+    // another thread when it exits, deleted with the queue
+    struct alignas(64) Record {
+        std::atomic<int> op{None};
+        std::atomic<bool> inUse{true};
+        Task task;
+        std::vector<Task>* batch = nullptr;
+        size_t maxTasks = 0;
+        size_t result = 0;
+        Record* next = nullptr;
+    };
+
+    Record* myRecord();
+    void publish(Record* record, Op op);
+    void combine();
+    void apply(Record& record);
+
+    const uint64_t id; // Distinguishes queues in the thread-local record cache
+    alignas(64) std::atomic<bool> combining{false};
+    alignas(64) std::atomic<Record*> records{nullptr};
+    alignas(64) std::atomic<size_t> count{0};
+    std::deque<Task> tasks; // Only touched by the combiner
+};
+
+} // namespace MB
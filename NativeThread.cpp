@@ -0,0 +1,217 @@
+#include "NativeThread.h"
+
+#include <exception>
+#include <memory>
+#include <system_error>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <climits>
+#include <csignal>
+#include <mutex>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+#endif
+
+namespace MB {
+
+NativeThread::~NativeThread() {
+    // Same contract as std::thread: must be joined before destruction
+    if (joinable()) {
+        std::terminate();
+    }
+}
+
+#if defined(_WIN32)
+
+void NativeThread::start(std::function<void()> body, size_t /*stackSize*/) {
+    thread = std::thread(std::move(body));
+}
+
+bool NativeThread::joinable() const {
+    return thread.joinable();
+}
+
+void NativeThread::join() {
+    thread.join();
+}
+
+bool NativeThread::requestStackDump() {
+    return false;
+}
+
+void applyThreadOptions(const ThreadOptions& options, const std::string& name) {
+    if (!name.empty()) {
+        std::wstring wide(name.begin(), name.end());
+        SetThreadDescription(GetCurrentThread(), wide.c_str());
+    }
+    switch (options.policy) {
+    case SchedulingPolicy::Batch:
+    case SchedulingPolicy::Idle:
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+        break;
+    case SchedulingPolicy::Fifo:
+    case SchedulingPolicy::RoundRobin:
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+        break;
+    case SchedulingPolicy::Inherit:
+        break;
+    }
+}
+
+#else
+
+namespace {
+
+void* trampoline(void* arg) {
+    std::unique_ptr<std::function<void()>> body(static_cast<std::function<void()>*>(arg));
+    (*body)();
+    return nullptr;
+}
+
+} // namespace
+
+void NativeThread::start(std::function<void()> body, size_t stackSize) {
+    auto heapBody = std::make_unique<std::function<void()>>(std::move(body));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (stackSize > 0) {
+        long page = sysconf(_SC_PAGESIZE);
+        size_t rounded = (stackSize + page - 1) / page * page;
+        if (rounded < static_cast<size_t>(PTHREAD_STACK_MIN)) {
+            rounded = PTHREAD_STACK_MIN;
+        }
+        pthread_attr_setstacksize(&attr, rounded); // Falls back to the default on failure
+    }
+    int err = pthread_create(&handle, &attr, trampoline, heapBody.get());
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        throw std::system_error(err, std::generic_category(), "pthread_create");
+    }
+    heapBody.release(); // Now owned by the thread
+    started = true;
+}
+
+bool NativeThread::joinable() const {
+    return started;
+}
+
+void NativeThread::join() {
+    pthread_join(handle, nullptr);
+    started = false;
+}
+
+#if defined(__GLIBC__)
+
+namespace {
+
+// Marks the SIGUSR2s we queue ourselves; anything else goes to whatever
+// handler the application had installed before us
+char dumpRequestTag;
+struct sigaction previousAction;
+
+void dumpStackHandler(int signal, siginfo_t* info, void* context) {
+    if (info->si_code != SI_QUEUE || info->si_value.sival_ptr != &dumpRequestTag) {
+        // SIG_DFL (terminate) isn't forwarded: restoring it would take our
+        // handler away for good, and re-installing it would catch the
+        // re-raised signal again, so a foreign SIGUSR2 is ignored instead
+        if (previousAction.sa_flags & SA_SIGINFO) {
+            previousAction.sa_sigaction(signal, info, context);
+        } else if (previousAction.sa_handler != SIG_DFL && previousAction.sa_handler != SIG_IGN) {
+            previousAction.sa_handler(signal);
+        }
+        return;
+    }
+    // backtrace_symbols_fd writes straight to the fd without allocating
+    void* frames[64];
+    int depth = backtrace(frames, 64);
+    static const char header[] = "[Watchdog] Stack of stalled worker:\n";
+    ssize_t ignored = write(STDERR_FILENO, header, sizeof(header) - 1);
+    (void)ignored;
+    backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+}
+
+} // namespace
+
+bool NativeThread::requestStackDump() {
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        // The first backtrace() call may load libgcc; do it outside the handler
+        void* warmup[1];
+        backtrace(warmup, 1);
+
+        struct sigaction action{};
+        action.sa_sigaction = dumpStackHandler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigaction(SIGUSR2, &action, &previousAction);
+    });
+    sigval value{};
+    value.sival_ptr = &dumpRequestTag;
+    return started && pthread_sigqueue(handle, SIGUSR2, value) == 0;
+}
+
+#else
+
+bool NativeThread::requestStackDump() {
+    return false;
+}
+
+#endif
+
+void applyThreadOptions(const ThreadOptions& options, const std::string& name) {
+    if (!name.empty()) {
+#if defined(__APPLE__)
+        pthread_setname_np(name.c_str());
+#elif defined(__linux__)
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#endif
+    }
+
+    sched_param param{};
+    switch (options.policy) {
+#if defined(__linux__)
+    case SchedulingPolicy::Batch:
+        pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+        break;
+    case SchedulingPolicy::Idle:
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+        break;
+#else
+    case SchedulingPolicy::Batch:
+    case SchedulingPolicy::Idle:
+        break;
+#endif
+    case SchedulingPolicy::Fifo:
+        param.sched_priority = options.priority;
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param); // EPERM unless privileged
+        break;
+    case SchedulingPolicy::RoundRobin:
+        param.sched_priority = options.priority;
+        pthread_setschedparam(pthread_self(), SCHED_RR, &param);
+        break;
+    case SchedulingPolicy::Inherit:
+        break;
+    }
+
+#if defined(__linux__)
+    // On Linux nice is per thread when addressed by thread id
+    if (options.setNice) {
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), options.nice);
+    }
+#endif
+}
+
+#endif
+
+} // namespace MB
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#if defined(_WIN32)
+#include <thread>
+#else
+#include <pthread.h>
+#endif
+
+namespace MB {
+
+enum class SchedulingPolicy {
+    Inherit,    // Whatever the creating thread has
+    Batch,      // Linux SCHED_BATCH: throughput work, fewer preemptions
+    Idle,       // Linux SCHED_IDLE: runs only when nothing else wants the CPU
+    Fifo,       // SCHED_FIFO real-time; usually needs CAP_SYS_NICE
+    RoundRobin  // SCHED_RR real-time; usually needs CAP_SYS_NICE
+};
+
+// How pool threads are created and presented to the OS. Every setting is
+// best effort: anything the platform or our privileges don't allow is
+// skipped and the thread runs with the default instead.
+struct ThreadOptions {
+    // Threads are named "<namePrefix>-<index>" (cut to 15 chars on Linux)
+    // so they can be told apart in top/perf. Empty keeps the inherited name.
+    std::string namePrefix;
+
+    SchedulingPolicy policy = SchedulingPolicy::Inherit;
+    int priority = 0;           // Real-time priority for Fifo/RoundRobin
+    bool setNice = false;
+    int nice = 0;               // Per-thread nice value (Linux)
+
+    // 0 keeps the platform default (often 8 MB reserved per thread).
+    size_t stackSize = 0;
+};
+
+// A joinable thread that honours ThreadOptions::stackSize, which
+// std::thread cannot do. Uses pthreads on POSIX and std::thread on Windows.
+class NativeThread {
+public:
+    NativeThread() = default;
+    ~NativeThread();
+
+    NativeThread(const NativeThread&) = delete;
+    NativeThread& operator=(const NativeThread&) = delete;
+
+    void start(std::function<void()> body, size_t stackSize = 0);
+    bool joinable() const;
+    void join();
+
+    // Ask the thread to print its own backtrace to stderr from a SIGUSR2
+    // handler. Linux/glibc only; returns false where unsupported. The first
+    // call installs that handler process-wide and it stays installed.
+    // SIGUSR2s not sent from here are passed on to the handler that was
+    // installed before it; if that was SIG_DFL they are ignored rather than
+    // terminating the process.
+    bool requestStackDump();
+
+private:
+#if defined(_WIN32)
+    std::thread thread;
+#else
+    pthread_t handle{};
+    bool started = false;
+#endif
+};
+
+// Apply name and scheduling settings to the calling thread.
+void applyThreadOptions(const ThreadOptions& options, const std::string& name);
+
+} // namespace MB
@@ -0,0 +1,355 @@
+#include "PerCpuTaskQueue.h"
+#include "SegmentedTaskQueue.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <thread>
+
+#if defined(__linux__) && defined(__x86_64__) && defined(__GNUC__) && __has_include(<sys/rseq.h>)
+#define MB_HAVE_RSEQ 1
+#include <linux/membarrier.h>
+#include <sched.h>
+#include <sys/rseq.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace MB {
+
+namespace {
+
+#if MB_HAVE_RSEQ
+// glibc registers rseq for every thread; we also need the membarrier
+// command that lets a stealer restart sequences on another CPU.
+bool registerRseq() {
+    if (__rseq_size == 0) {
+        return false;
+    }
+    return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ, 0, 0) == 0;
+}
+
+inline unsigned rseqCpu() {
+    auto* area = reinterpret_cast<volatile struct rseq*>(
+        static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+    return area->cpu_id;
+}
+#endif
+
+bool rseqAvailable() {
+#if MB_HAVE_RSEQ
+    static const bool available = registerRseq();
+    return available;
+#else
+    return false;
+#endif
+}
+
+unsigned cpuCount() {
+#if defined(__linux__)
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+    if (configured > 0) {
+        return static_cast<unsigned>(configured);
+    }
+#endif
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+} // namespace
+
+PerCpuTaskQueue::PerCpuTaskQueue()
+    : rseq(rseqAvailable()),
+      shardCount(rseq ? cpuCount() : 0),
+      shards(rseq ? new Shard[shardCount] : nullptr) {
+    if (!rseq) {
+        // Without rseq a shard would need a lock on every operation, and a
+        // preempted holder would stall its whole CPU's queue
+        fallback = std::make_unique<SegmentedTaskQueue>();
+    }
+}
+
+PerCpuTaskQueue::~PerCpuTaskQueue() {
+    for (unsigned i = 0; i < shardCount; ++i) {
+        Shard& shard = shards[i];
+        for (uint64_t h = shard.head; h != shard.tail; ++h) {
+            delete shard.slots[h % kShardCapacity].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+unsigned PerCpuTaskQueue::currentCpu() const {
+#if MB_HAVE_RSEQ
+    if (rseq) {
+        return rseqCpu();
+    }
+#endif
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return static_cast<unsigned>(cpu) % shardCount;
+    }
+#endif
+    // No CPU number: spread threads over the shards instead
+    return static_cast<unsigned>(std::hash<std::thread::id>()(std::this_thread::get_id()) %
+                                 shardCount);
+}
+
+// The two restartable sequences below follow the librseq layout: a
+// descriptor in __rseq_cs covering [1, 2), armed by storing its address in
+// the thread's rseq area, and an abort handler at 4 preceded by RSEQ_SIG.
+// The kernel jumps to 4 if the thread is preempted, migrated or signalled
+// between 1 and 2; the single commit store ends the sequence. Bailing out
+// when `locked` is set keeps us off a shard a stealer is working on.
+
+PerCpuTaskQueue::Result PerCpuTaskQueue::pushCurrent(unsigned cpu, Task* item) {
+#if MB_HAVE_RSEQ
+    {
+        Shard* shard = &shards[cpu];
+        asm goto(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %%fs:8(%[area])\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %%fs:4(%[area])\n\t"
+            "jnz %l[aborted]\n\t"
+            "cmpl $0, %c[lockedOff](%[shard])\n\t"
+            "jnz %l[aborted]\n\t"
+            "movq %c[tailOff](%[shard]), %%rax\n\t"
+            "movq %%rax, %%rcx\n\t"
+            "subq %c[headOff](%[shard]), %%rcx\n\t"
+            "cmpq %[capacity], %%rcx\n\t"
+            "jae %l[full]\n\t"
+            "movq %%rax, %%rcx\n\t"
+            "andq %[mask], %%rcx\n\t"
+            "movq %[item], %c[slotsOff](%[shard], %%rcx, 8)\n\t"
+            "incq %%rax\n\t"
+            "movq %%rax, %c[tailOff](%[shard])\n\t" // Commit
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[aborted]\n\t"
+            ".popsection\n\t"
+            :
+            : [area] "r"(__rseq_offset), [cpu] "r"(cpu), [shard] "r"(shard), [item] "r"(item),
+              [capacity] "i"(kShardCapacity), [mask] "i"(kShardCapacity - 1),
+              [headOff] "i"(offsetof(Shard, head)), [tailOff] "i"(offsetof(Shard, tail)),
+              [lockedOff] "i"(offsetof(Shard, locked)), [slotsOff] "i"(offsetof(Shard, slots))
+            : "memory", "cc", "rax", "rcx"
+            : aborted, full);
+        return Result::Done;
+    full:
+        return Result::Full;
+    aborted:
+        return Result::Aborted;
+    }
+#else
+    // Never called: without rseq everything goes to the fallback queue
+    (void)cpu;
+    (void)item;
+    return Result::Full;
+#endif
+}
+
+PerCpuTaskQueue::Result PerCpuTaskQueue::popCurrent(unsigned cpu, Task*& item) {
+#if MB_HAVE_RSEQ
+    {
+        Shard* shard = &shards[cpu];
+        asm goto(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %%fs:8(%[area])\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %%fs:4(%[area])\n\t"
+            "jnz %l[aborted]\n\t"
+            "cmpl $0, %c[lockedOff](%[shard])\n\t"
+            "jnz %l[aborted]\n\t"
+            "movq %c[headOff](%[shard]), %%rax\n\t"
+            "cmpq %c[tailOff](%[shard]), %%rax\n\t"
+            "je %l[empty]\n\t"
+            "movq %%rax, %%rcx\n\t"
+            "andq %[mask], %%rcx\n\t"
+            "movq %c[slotsOff](%[shard], %%rcx, 8), %%rcx\n\t"
+            "movq %%rcx, (%[out])\n\t"
+            "incq %%rax\n\t"
+            "movq %%rax, %c[headOff](%[shard])\n\t" // Commit
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[aborted]\n\t"
+            ".popsection\n\t"
+            :
+            : [area] "r"(__rseq_offset), [cpu] "r"(cpu), [shard] "r"(shard), [out] "r"(&item),
+              [mask] "i"(kShardCapacity - 1),
+              [headOff] "i"(offsetof(Shard, head)), [tailOff] "i"(offsetof(Shard, tail)),
+              [lockedOff] "i"(offsetof(Shard, locked)), [slotsOff] "i"(offsetof(Shard, slots))
+            : "memory", "cc", "rax", "rcx"
+            : aborted, empty);
+        return Result::Done;
+    empty:
+        return Result::Empty;
+    aborted:
+        return Result::Aborted;
+    }
+#else
+    (void)cpu;
+    (void)item;
+    return Result::Empty;
+#endif
+}
+
+void PerCpuTaskQueue::lock(Shard& shard, unsigned cpu) {
+    unsigned spins = 0;
+    while (shard.locked.exchange(1, std::memory_order_acquire) != 0) {
+        while (shard.locked.load(std::memory_order_relaxed) != 0) {
+            // The holder may have been preempted on this very CPU
+            if (++spins > 64) {
+                std::this_thread::yield();
+            } else {
+                cpuRelax();
+            }
+        }
+    }
+#if MB_HAVE_RSEQ
+    // Restart any sequence on that CPU that started before it could see
+    // the lock; later ones bail out on their own
+    syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ,
+            MEMBARRIER_CMD_FLAG_CPU, cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+void PerCpuTaskQueue::unlock(Shard& shard) {
+    shard.locked.store(0, std::memory_order_release);
+}
+
+size_t PerCpuTaskQueue::popLocked(Shard& shard, std::vector<Task>& out, size_t maxTasks) {
+    uint64_t h = shard.head.load(std::memory_order_relaxed);
+    uint64_t available = shard.tail.load(std::memory_order_acquire) - h;
+    // Half of the victim's backlog, rounded up
+    size_t n = std::min<size_t>(maxTasks, (available + 1) / 2);
+    for (size_t i = 0; i < n; ++i) {
+        Task* item = shard.slots[(h + i) % kShardCapacity].load(std::memory_order_relaxed);
+        out.push_back(std::move(*item));
+        delete item;
+    }
+    shard.head.store(h + n, std::memory_order_release);
+    return n;
+}
+
+void PerCpuTaskQueue::push(Task task) {
+    if (fallback) {
+        fallback->push(std::move(task));
+        return;
+    }
+    Task* item = new Task(std::move(task));
+    while (true) {
+        unsigned cpu = currentCpu();
+        if (cpu >= shardCount) {
+            break; // CPU hotplugged in since we sized the shards
+        }
+        Result result = pushCurrent(cpu, item);
+        if (result == Result::Done) {
+            return;
+        }
+        if (result == Result::Full) {
+            break;
+        }
+        // Preempted, migrated or a stealer holds the shard: try again
+        while (shards[cpu].locked.load(std::memory_order_relaxed) != 0) {
+            std::this_thread::yield();
+        }
+    }
+    overflow.push(std::move(*item));
+    delete item;
+}
+
+void PerCpuTaskQueue::pushBulk(std::vector<Task>& batch) {
+    if (fallback) {
+        fallback->pushBulk(batch);
+        return;
+    }
+    for (Task& task : batch) {
+        push(std::move(task));
+    }
+}
+
+size_t PerCpuTaskQueue::popBatch(std::vector<Task>& out, size_t maxTasks) {
+    if (fallback) {
+        return fallback->popBatch(out, maxTasks);
+    }
+    size_t taken = 0;
+    unsigned cpu = currentCpu();
+    if (cpu < shardCount) {
+        unsigned aborts = 0;
+        while (taken < maxTasks) {
+            Task* item = nullptr;
+            Result result = popCurrent(cpu, item);
+            if (result == Result::Done) {
+                out.push_back(std::move(*item));
+                delete item;
+                ++taken;
+            } else if (result == Result::Empty || ++aborts > 8) {
+                break;
+            } else {
+                cpu = currentCpu();
+                if (cpu >= shardCount) {
+                    break;
+                }
+            }
+        }
+    }
+    if (taken == 0) {
+        taken = overflow.popBatch(out, maxTasks);
+    }
+    // Steal from the other CPUs, nearest index first
+    for (unsigned i = 1; taken == 0 && i <= shardCount; ++i) {
+        unsigned victim = (cpu + i) % shardCount;
+        Shard& shard = shards[victim];
+        if (shard.tail.load(std::memory_order_relaxed) ==
+            shard.head.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        lock(shard, victim);
+        taken = popLocked(shard, out, maxTasks);
+        unlock(shard);
+    }
+    return taken;
+}
+
+size_t PerCpuTaskQueue::size() const {
+    if (fallback) {
+        return fallback->size();
+    }
+    size_t total = overflow.size();
+    for (unsigned i = 0; i < shardCount; ++i) {
+        // Head first: tail only grows, so the difference can't go negative
+        uint64_t h = shards[i].head.load(std::memory_order_seq_cst);
+        total += shards[i].tail.load(std::memory_order_seq_cst) - h;
+    }
+    return total;
+}
+
+} // namespace MB
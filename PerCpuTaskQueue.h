@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "TaskQueue.h"
+
+namespace MB {
+
+// One bounded FIFO per CPU. On Linux/x86-64 with restartable sequences
+// (glibc 2.35+ registers them) a thread pushes to and pops from its current
+// CPU's queue with plain loads and stores: the kernel restarts the sequence
+// if the thread is preempted or migrated before the final store. Without
+// rseq (registration failed, or not Linux/x86-64) the queue is a
+// SegmentedTaskQueue underneath, lock-free and FIFO.
+//
+// Consumers that find their CPU's queue empty steal half of another CPU's
+// queue under its lock, after a membarrier restarts any sequence still
+// running on that CPU. Pushes to a full queue spill into a shared mutex
+// queue.
+//
+// Order is kept only within one CPU's queue. Tasks pushed on different
+// CPUs, by different producers or by one that migrated, and tasks that
+// spilled, come out in no particular order relative to each other.
+class PerCpuTaskQueue : public TaskQueue {
+public:
+    PerCpuTaskQueue();
+    ~PerCpuTaskQueue() override;
+
+    PerCpuTaskQueue(const PerCpuTaskQueue&) = delete;
+    PerCpuTaskQueue& operator=(const PerCpuTaskQueue&) = delete;
+
+    void push(Task task) override;
+    void pushBulk(std::vector<Task>& batch) override;
+    size_t popBatch(std::vector<Task>& out, size_t maxTasks) override;
+    size_t size() const override;
+
+    // False when rseq is unavailable and the segmented fallback is in use
+    bool usesRseq() const { return rseq; }
+
+private:
+    static constexpr size_t kShardCapacity = 1024;
+
+    struct alignas(64) Shard {
+        // Monotonic; the item count is tail - head
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+        std::atomic<uint32_t> locked{0};
+        std::atomic<Task*> slots[kShardCapacity];
+    };
+
+    enum class Result { Done, Full, Empty, Aborted };
+
+    Result pushCurrent(unsigned cpu, Task* item);
+    Result popCurrent(unsigned cpu, Task*& item);
+    size_t popLocked(Shard& shard, std::vector<Task>& out, size_t maxTasks);
+    void lock(Shard& shard, unsigned cpu);
+    void unlock(Shard& shard);
+    unsigned currentCpu() const;
+
+    const bool rseq;
+    const unsigned shardCount;
+    std::unique_ptr<Shard[]> shards;
+    MutexTaskQueue overflow;
+    std::unique_ptr<TaskQueue> fallback; // Set when rseq is unavailable
+};
+
+} // namespace MB
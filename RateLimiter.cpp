@@ -0,0 +1,164 @@
+#include "RateLimiter.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+namespace MB {
+
+TokenBucket::TokenBucket(double tokensPerSecond, double burst) {
+    setRate(tokensPerSecond, burst);
+}
+
+void TokenBucket::setRate(double tokensPerSecond, double burst) {
+    int64_t step = tokensPerSecond > 0 ? static_cast<int64_t>(1e9 / tokensPerSecond) : 0;
+    interval.store(step, std::memory_order_relaxed);
+    tolerance.store(static_cast<int64_t>((std::max(burst, 1.0) - 1.0) * step),
+                    std::memory_order_relaxed);
+    // Debt run up at the old rate is worth at most one token at the new one,
+    // so a faster rate takes effect now rather than after the old backlog
+    int64_t limit = nowNs() + step;
+    int64_t current = arrival.load(std::memory_order_relaxed);
+    while (current > limit &&
+           !arrival.compare_exchange_weak(current, limit, std::memory_order_relaxed)) {
+    }
+}
+
+int64_t TokenBucket::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+std::chrono::nanoseconds TokenBucket::tryAcquire() {
+    if (interval.load(std::memory_order_relaxed) == 0) {
+        return std::chrono::nanoseconds(0); // Unlimited
+    }
+    int64_t now = nowNs();
+    int64_t current = arrival.load(std::memory_order_relaxed);
+    while (true) {
+        int64_t step = interval.load(std::memory_order_relaxed);
+        int64_t base = std::max(current, now);
+        int64_t wait = base - now - tolerance.load(std::memory_order_relaxed);
+        if (wait > 0) {
+            return std::chrono::nanoseconds(wait);
+        }
+        if (arrival.compare_exchange_weak(current, base + step, std::memory_order_relaxed)) {
+            return std::chrono::nanoseconds(0);
+        }
+    }
+}
+
+std::chrono::nanoseconds TokenBucket::timeUntilAvailable() const {
+    if (interval.load(std::memory_order_relaxed) == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    int64_t now = nowNs();
+    int64_t base = std::max(arrival.load(std::memory_order_relaxed), now);
+    int64_t wait = base - now - tolerance.load(std::memory_order_relaxed);
+    return std::chrono::nanoseconds(std::max<int64_t>(wait, 0));
+}
+
+struct RateLimiter::State {
+    State(ThreadPool& pool, double tasksPerSecond, double burst)
+        : pool(pool), bucket(tasksPerSecond, burst) {}
+
+    ThreadPool& pool;
+    TokenBucket bucket;
+
+    std::mutex mutex;
+    std::queue<std::function<void()>> deferred;
+    std::atomic<size_t> deferredCount = 0;
+    bool drainScheduled = false; // Guarded by mutex
+    uint64_t drainGeneration = 0; // Guarded by mutex; bumped by setRate()
+};
+
+RateLimiter::RateLimiter(ThreadPool& pool, double tasksPerSecond, double burst)
+    : state(std::make_shared<State>(pool, tasksPerSecond, burst)) {}
+
+RateLimiter::~RateLimiter() {
+    drain(state, true);
+}
+
+void RateLimiter::enqueue(std::function<void()> task) {
+    State& s = *state;
+    // Fast path: nothing waiting ahead of us and a token to spare
+    if (s.deferredCount.load(std::memory_order_acquire) == 0 &&
+        s.bucket.tryAcquire().count() == 0) {
+        s.pool.enqueue(std::move(task));
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(s.mutex);
+        s.deferred.push(std::move(task));
+        s.deferredCount.fetch_add(1, std::memory_order_release);
+    }
+    arm(state);
+}
+
+void RateLimiter::setRate(double tasksPerSecond, double burst) {
+    state->bucket.setRate(tasksPerSecond, burst);
+    {
+        // The pending timer was armed for the old rate; let drain() arm a
+        // new one for whatever the new rate leaves deferred
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->drainScheduled = false;
+        ++state->drainGeneration;
+    }
+    // A faster rate may make deferred work runnable sooner than planned
+    drain(state, false);
+}
+
+size_t RateLimiter::getDeferredCount() const {
+    return state->deferredCount.load(std::memory_order_relaxed);
+}
+
+void RateLimiter::arm(const std::shared_ptr<State>& state) {
+    uint64_t generation;
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (state->drainScheduled || state->deferred.empty()) {
+            return;
+        }
+        state->drainScheduled = true;
+        generation = state->drainGeneration;
+    }
+    // Called unlocked: after shutdown the timer runs the callback inline
+    std::shared_ptr<State> keepAlive = state;
+    state->pool.enqueueAfter(state->bucket.timeUntilAvailable(), [keepAlive, generation] {
+        {
+            // A timer from before a rate change still drains, but no longer
+            // counts as the scheduled one
+            std::unique_lock<std::mutex> lock(keepAlive->mutex);
+            if (generation == keepAlive->drainGeneration) {
+                keepAlive->drainScheduled = false;
+            }
+        }
+        drain(keepAlive, keepAlive->pool.isShuttingDown());
+    });
+}
+
+void RateLimiter::drain(const std::shared_ptr<State>& state, bool releaseAll) {
+    State& s = *state;
+    std::vector<std::function<void()>> ready;
+    {
+        std::unique_lock<std::mutex> lock(s.mutex);
+        while (!s.deferred.empty()) {
+            if (!releaseAll && s.bucket.tryAcquire().count() != 0) {
+                break;
+            }
+            ready.push_back(std::move(s.deferred.front()));
+            s.deferred.pop();
+            s.deferredCount.fetch_sub(1, std::memory_order_release);
+        }
+    }
+    for (auto &task : ready) {
+        s.pool.enqueue(std::move(task));
+    }
+    arm(state);
+}
+
+} // namespace MB
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace MB {
+
+class ThreadPool;
+
+// Lock-free token bucket in its GCRA form: one atomic "theoretical arrival
+// time" advanced by a CAS per token, so there is no refill thread and no
+// lock. Rate and burst may be changed while other threads acquire.
+class TokenBucket {
+public:
+    TokenBucket(double tokensPerSecond, double burst);
+
+    // A rate <= 0 removes the limit. Takes effect at once: waits already
+    // owed at the old rate shrink to at most one token at the new one.
+    void setRate(double tokensPerSecond, double burst);
+
+    // Takes a token and returns zero, or returns how long until one is free.
+    std::chrono::nanoseconds tryAcquire();
+    // How long until a token is free, without taking one.
+    std::chrono::nanoseconds timeUntilAvailable() const;
+
+private:
+    static int64_t nowNs();
+
+    std::atomic<int64_t> arrival{0};   // Theoretical arrival time (ns)
+    std::atomic<int64_t> interval{0};  // ns per token
+    std::atomic<int64_t> tolerance{0}; // (burst - 1) * interval
+};
+
+// A rate-limited class of work on a ThreadPool, e.g. calls into a disk-bound
+// backend. Tasks within budget go straight to the pool; the rest wait in
+// FIFO order and are released by the pool's timer as tokens free up, so no
+// thread sleeps or spins on the budget.
+//
+//     MB::RateLimiter disk(pool, 200.0, 20.0); // 200 tasks/s, bursts of 20
+//     disk.enqueue([] { /* ... */ });
+//
+// Tasks still deferred when the limiter or the pool goes away are released
+// immediately rather than dropped. Declare the limiter after its pool.
+class RateLimiter {
+public:
+    RateLimiter(ThreadPool& pool, double tasksPerSecond, double burst = 1.0);
+    ~RateLimiter();
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    void enqueue(std::function<void()> task);
+    // Deferred tasks are released at the new rate from now on; a rate <= 0
+    // releases them all at once.
+    void setRate(double tasksPerSecond, double burst = 1.0);
+    size_t getDeferredCount() const;
+
+private:
+    struct State;
+    static void drain(const std::shared_ptr<State>& state, bool releaseAll);
+    static void arm(const std::shared_ptr<State>& state);
+
+    std::shared_ptr<State> state; // Shared with pending timer callbacks
+};
+
+} // namespace MB
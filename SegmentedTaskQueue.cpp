@@ -0,0 +1,206 @@
+#include "SegmentedTaskQueue.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "Epoch.h"
+
+namespace MB {
+
+namespace {
+
+using Segment = SegmentedTaskQueue::Segment;
+using Slot = SegmentedTaskQueue::Slot;
+using Task = TaskQueue::Task;
+
+// Free segments shared by every queue. Segments are only needed once per
+// kSegmentSize tasks, so a mutex is fine here.
+struct SegmentPool {
+    static constexpr size_t kMaxCached = 32;
+
+    std::mutex mutex;
+    std::vector<Segment*> free;
+};
+
+// Never destroyed: epoch may hand segments back during static teardown
+SegmentPool& segmentPool() {
+    static SegmentPool* pool = new SegmentPool();
+    return *pool;
+}
+
+Segment* allocateSegment(uint64_t id) {
+    Segment* segment = nullptr;
+    {
+        SegmentPool& pool = segmentPool();
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        if (!pool.free.empty()) {
+            segment = pool.free.back();
+            pool.free.pop_back();
+        }
+    }
+    if (!segment) {
+        segment = new Segment();
+    }
+    segment->enqueueIndex.store(0, std::memory_order_relaxed);
+    segment->dequeueIndex.store(0, std::memory_order_relaxed);
+    segment->next.store(nullptr, std::memory_order_relaxed);
+    segment->id = id;
+    for (Slot& slot : segment->slots) {
+        slot.state.store(Slot::Empty, std::memory_order_relaxed);
+        slot.task = nullptr;
+    }
+    return segment;
+}
+
+void recycleSegment(void* p) {
+    Segment* segment = static_cast<Segment*>(p);
+    {
+        SegmentPool& pool = segmentPool();
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        if (pool.free.size() < SegmentPool::kMaxCached) {
+            pool.free.push_back(segment);
+            return;
+        }
+    }
+    delete segment;
+}
+
+} // namespace
+
+SegmentedTaskQueue::SegmentedTaskQueue() {
+    Segment* first = allocateSegment(0);
+    head.store(first, std::memory_order_relaxed);
+    tail.store(first, std::memory_order_relaxed);
+}
+
+SegmentedTaskQueue::~SegmentedTaskQueue() {
+    // Destroy unclaimed tasks now: a pooled segment would otherwise keep
+    // their captures alive until it is reused
+    Segment* segment = head.load(std::memory_order_relaxed);
+    while (segment) {
+        Segment* next = segment->next.load(std::memory_order_relaxed);
+        uint64_t first = std::min<uint64_t>(
+            segment->dequeueIndex.load(std::memory_order_relaxed), kSegmentSize);
+        uint64_t last = std::min<uint64_t>(
+            segment->enqueueIndex.load(std::memory_order_relaxed), kSegmentSize);
+        for (uint64_t i = first; i < last; ++i) {
+            Slot& slot = segment->slots[i];
+            if (slot.state.load(std::memory_order_relaxed) == Slot::Ready) {
+                slot.task = nullptr;
+            }
+        }
+        recycleSegment(segment);
+        segment = next;
+    }
+}
+
+void SegmentedTaskQueue::enqueue(Task& task) {
+    epoch::Guard guard;
+    while (true) {
+        Segment* last = tail.load(std::memory_order_acquire);
+        uint64_t index = last->enqueueIndex.fetch_add(1, std::memory_order_seq_cst);
+        if (index < kSegmentSize) {
+            Slot& slot = last->slots[index];
+            slot.task = std::move(task);
+            uint32_t expected = Slot::Empty;
+            if (slot.state.compare_exchange_strong(expected, Slot::Ready,
+                                                   std::memory_order_seq_cst)) {
+                return;
+            }
+            // A consumer gave up on the slot first; take the task back
+            task = std::move(slot.task);
+            continue;
+        }
+
+        // Segment full: append a new one holding our task, or help the
+        // producer that already did move the tail along
+        if (last != tail.load(std::memory_order_acquire)) {
+            continue;
+        }
+        Segment* next = last->next.load(std::memory_order_acquire);
+        if (next) {
+            tail.compare_exchange_strong(last, next, std::memory_order_seq_cst);
+            continue;
+        }
+        Segment* fresh = allocateSegment(last->id + 1);
+        fresh->enqueueIndex.store(1, std::memory_order_relaxed);
+        fresh->slots[0].task = std::move(task);
+        fresh->slots[0].state.store(Slot::Ready, std::memory_order_relaxed);
+        if (last->next.compare_exchange_strong(next, fresh, std::memory_order_seq_cst)) {
+            // size() reads the tail, so it must move before we return
+            tail.compare_exchange_strong(last, fresh, std::memory_order_seq_cst);
+            return;
+        }
+        // Never published, so nobody else can be looking at it
+        task = std::move(fresh->slots[0].task);
+        recycleSegment(fresh);
+    }
+}
+
+bool SegmentedTaskQueue::dequeue(Task& task) {
+    epoch::Guard guard;
+    while (true) {
+        Segment* first = head.load(std::memory_order_acquire);
+        if (first->dequeueIndex.load(std::memory_order_seq_cst) >=
+                first->enqueueIndex.load(std::memory_order_seq_cst) &&
+            first->next.load(std::memory_order_acquire) == nullptr) {
+            return false;
+        }
+        uint64_t index = first->dequeueIndex.fetch_add(1, std::memory_order_seq_cst);
+        if (index < kSegmentSize) {
+            Slot& slot = first->slots[index];
+            if (slot.state.exchange(Slot::Taken, std::memory_order_seq_cst) == Slot::Ready) {
+                task = std::move(slot.task);
+                slot.task = nullptr;
+                return true;
+            }
+            continue; // Its producer hasn't published yet and will retry
+        }
+
+        // Segment drained: move the head on and recycle it once no thread
+        // can still be reading it
+        Segment* next = first->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        if (head.compare_exchange_strong(first, next, std::memory_order_release)) {
+            epoch::retire(first, recycleSegment);
+        }
+    }
+}
+
+void SegmentedTaskQueue::push(Task task) {
+    enqueue(task);
+}
+
+void SegmentedTaskQueue::pushBulk(std::vector<Task>& batch) {
+    for (Task& task : batch) {
+        enqueue(task);
+    }
+}
+
+size_t SegmentedTaskQueue::popBatch(std::vector<Task>& out, size_t maxTasks) {
+    size_t n = 0;
+    Task task;
+    for (; n < maxTasks && dequeue(task); ++n) {
+        out.push_back(std::move(task));
+    }
+    return n;
+}
+
+size_t SegmentedTaskQueue::size() const {
+    epoch::Guard guard;
+    // Claimed indices, including slots that were skipped; approximate
+    Segment* first = head.load(std::memory_order_seq_cst);
+    Segment* last = tail.load(std::memory_order_seq_cst);
+    uint64_t dequeued = first->id * kSegmentSize +
+                        std::min<uint64_t>(first->dequeueIndex.load(std::memory_order_seq_cst),
+                                           kSegmentSize);
+    uint64_t enqueued = last->id * kSegmentSize +
+                        std::min<uint64_t>(last->enqueueIndex.load(std::memory_order_seq_cst),
+                                           kSegmentSize);
+    return enqueued > dequeued ? static_cast<size_t>(enqueued - dequeued) : 0;
+}
+
+} // namespace MB
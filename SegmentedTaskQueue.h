@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "TaskQueue.h"
+
+namespace MB {
+
+// Unbounded lock-free MPMC FIFO: a Michael-Scott list of fixed-size arrays.
+// Producers and consumers claim slots in the tail and head segments with a
+// fetch-and-add; only moving to a new segment takes a CAS. Drained segments
+// are retired through MB::epoch and recycled through a shared segment pool
+// rather than going back to the allocator.
+class SegmentedTaskQueue : public TaskQueue {
+public:
+    SegmentedTaskQueue();
+    ~SegmentedTaskQueue() override;
+
+    SegmentedTaskQueue(const SegmentedTaskQueue&) = delete;
+    SegmentedTaskQueue& operator=(const SegmentedTaskQueue&) = delete;
+
+    void push(Task task) override;
+    void pushBulk(std::vector<Task>& batch) override;
+    size_t popBatch(std::vector<Task>& out, size_t maxTasks) override;
+    size_t size() const override;
+
+    static constexpr size_t kSegmentSize = 1024;
+
+    // Each index is claimed by exactly one producer and one consumer. The
+    // producer stores the task and then flips Empty -> Ready; a consumer
+    // that gets there first flips Empty -> Taken and the producer retries
+    // at a new index.
+    struct Slot {
+        enum State : uint32_t { Empty, Ready, Taken };
+        std::atomic<uint32_t> state{Empty};
+        Task task;
+    };
+
+    struct Segment {
+        std::atomic<uint64_t> enqueueIndex{0};
+        alignas(64) std::atomic<uint64_t> dequeueIndex{0};
+        alignas(64) std::atomic<Segment*> next{nullptr};
+        uint64_t id = 0; // Position in the list, for size()
+        Slot slots[kSegmentSize];
+    };
+
+private:
+    void enqueue(Task& task);
+    bool dequeue(Task& task);
+
+    alignas(64) std::atomic<Segment*> head;
+    alignas(64) std::atomic<Segment*> tail;
+};
+
+} // namespace MB
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "ThreadPool.h"
+
+namespace MB {
+
+// Coalesces duplicate work by key on a ThreadPool. enqueueOnce() runs the
+// task only if no task for the same key is in flight; otherwise the caller
+// attaches to the running one. Every caller gets the same shared_future,
+// holding the result or the exception.
+//
+//     MB::SingleFlight<std::string, Report> reports(pool);
+//     auto report = reports.enqueueOnce(id, [id] { return buildReport(id); });
+//
+// In-flight keys live in a map split into shards by hash, each with its own
+// lock, so unrelated keys don't contend. A key is forgotten once its result
+// is set; later submissions run the task again.
+template <typename Key, typename Result, typename Hash = std::hash<Key>>
+class SingleFlight {
+public:
+    explicit SingleFlight(ThreadPool& pool) : pool(pool), state(std::make_shared<State>()) {}
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    template <typename Task>
+    std::shared_future<Result> enqueueOnce(const Key& key, Task task) {
+        size_t hash = Hash{}(key);
+        Shard& shard = state->shards[hash % kShards];
+
+        auto promise = std::make_shared<std::promise<Result>>();
+        std::shared_future<Result> result;
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.inFlight.find(key);
+            if (it != shard.inFlight.end()) {
+                ++shard.coalesced;
+                return it->second;
+            }
+            result = promise->get_future().share();
+            shard.inFlight.emplace(key, result);
+            ++shard.started;
+        }
+
+        // The state outlives this object until the task has run. The task
+        // is held by pointer because the pool's queues need copyable
+        // callables and it may be move-only.
+        auto body = std::make_shared<Task>(std::move(task));
+        pool.enqueue([state = state, &shard, key, promise, body] {
+            try {
+                if constexpr (std::is_void_v<Result>) {
+                    (*body)();
+                    promise->set_value();
+                } else {
+                    promise->set_value((*body)());
+                }
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+            // After the result is set, so callers arriving meanwhile still
+            // attach instead of starting a second run
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            shard.inFlight.erase(key);
+        });
+        return result;
+    }
+
+    // Tasks actually started, and submissions that attached to one instead
+    uint64_t getStartedCount() const { return sum(&Shard::started); }
+    uint64_t getCoalescedCount() const { return sum(&Shard::coalesced); }
+
+private:
+    static constexpr size_t kShards = 16;
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<Key, std::shared_future<Result>, Hash> inFlight;
+        uint64_t started = 0;
+        uint64_t coalesced = 0;
+    };
+
+    struct State {
+        std::array<Shard, kShards> shards;
+    };
+
+    uint64_t sum(uint64_t Shard::*counter) const {
+        uint64_t total = 0;
+        for (const Shard& shard : state->shards) {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            total += shard.*counter;
+        }
+        return total;
+    }
+
+    ThreadPool& pool;
+    std::shared_ptr<State> state;
+};
+
+} // namespace MB
@@ -0,0 +1,47 @@
+#include "TaskQueue.h"
+#include "FlatCombiningQueue.h"
+#include "PerCpuTaskQueue.h"
+#include "SegmentedTaskQueue.h"
+
+namespace MB {
+
+std::unique_ptr<TaskQueue> makeTaskQueue(QueueBackend backend) {
+    switch (backend) {
+    case QueueBackend::FlatCombining:
+        return std::make_unique<FlatCombiningQueue>();
+    case QueueBackend::PerCpu:
+        return std::make_unique<PerCpuTaskQueue>();
+    case QueueBackend::Segmented:
+        return std::make_unique<SegmentedTaskQueue>();
+    case QueueBackend::Mutex:
+        break;
+    }
+    return std::make_unique<MutexTaskQueue>();
+}
+
+void MutexTaskQueue::push(Task task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    tasks.push(std::move(task));
+    count.store(tasks.size(), std::memory_order_relaxed);
+}
+
+void MutexTaskQueue::pushBulk(std::vector<Task>& batch) {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (auto &task : batch) {
+        tasks.push(std::move(task));
+    }
+    count.store(tasks.size(), std::memory_order_relaxed);
+}
+
+size_t MutexTaskQueue::popBatch(std::vector<Task>& out, size_t maxTasks) {
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t n = 0;
+    for (; n < maxTasks && !tasks.empty(); ++n) {
+        out.push_back(std::move(tasks.front()));
+        tasks.pop();
+    }
+    count.store(tasks.size(), std::memory_order_relaxed);
+    return n;
+}
+
+} // namespace MB
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+namespace MB {
+
+// Storage behind the pool's shared injection queue, where submissions from
+// outside the pool land. Implementations are MPMC. All but PerCpu are also
+// FIFO across producers; PerCpu is FIFO only within one CPU's queue.
+class TaskQueue {
+public:
+    using Task = std::function<void()>;
+
+    virtual ~TaskQueue() = default;
+
+    virtual void push(Task task) = 0;
+    // Moves every task out of `batch` (which is left with empty functions).
+    virtual void pushBulk(std::vector<Task>& batch) = 0;
+    // Appends up to maxTasks tasks to `out`, oldest first where the backend
+    // keeps order; returns how many.
+    virtual size_t popBatch(std::vector<Task>& out, size_t maxTasks) = 0;
+    // Lock-free and approximate under concurrent use.
+    virtual size_t size() const = 0;
+};
+
+enum class QueueBackend {
+    Mutex,        // std::queue behind one mutex
+    FlatCombining, // One thread applies everyone's pending operations per pass
+    PerCpu,        // One queue per CPU, rseq on Linux/x86-64, with stealing.
+                   // Not FIFO: tasks pushed on different CPUs (including by
+                   // one producer that migrates) can run in any order.
+    Segmented      // Unbounded lock-free list of arrays
+};
+
+std::unique_ptr<TaskQueue> makeTaskQueue(QueueBackend backend);
+
+class MutexTaskQueue : public TaskQueue {
+public:
+    void push(Task task) override;
+    void pushBulk(std::vector<Task>& batch) override;
+    size_t popBatch(std::vector<Task>& out, size_t maxTasks) override;
+    size_t size() const override { return count.load(std::memory_order_seq_cst); }
+
+private:
+    std::mutex mutex;
+    std::queue<Task> tasks;
+    std::atomic<size_t> count = 0; // tasks.size(), readable without the lock
+};
+
+} // namespace MB
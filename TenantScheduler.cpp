@@ -0,0 +1,131 @@
+#include "TenantScheduler.h"
+
+#include <algorithm>
+
+namespace MB {
+
+bool TenantScheduler::push(TenantId tenant, std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Tenant& t = tenantLocked(tenant);
+    t.tasks.push(std::move(task));
+    ++t.stats.submitted;
+    queued.fetch_add(1, std::memory_order_relaxed);
+    return relinkLocked(t);
+}
+
+bool TenantScheduler::tryPop(std::function<void()>& task, TenantId& tenant) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Tenant* t = head;
+    if (!t) {
+        return false;
+    }
+
+    if (t->deficit == 0) {
+        t->deficit = t->weight; // Start of this tenant's turn
+    }
+    task = std::move(t->tasks.front());
+    t->tasks.pop();
+    --t->deficit;
+    ++t->running;
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    tenant = t->id;
+
+    if (!t->runnable()) {
+        unlink(*t);
+        t->deficit = 0;
+    } else if (t->deficit == 0) {
+        // Turn used up: go to the back of the ring
+        unlink(*t);
+        link(*t);
+    }
+    return true;
+}
+
+bool TenantScheduler::complete(TenantId tenant, std::chrono::nanoseconds elapsed) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Tenant& t = tenantLocked(tenant);
+    --t.running;
+    ++t.stats.completed;
+    t.stats.busyTime += elapsed;
+    return relinkLocked(t);
+}
+
+bool TenantScheduler::setWeight(TenantId tenant, unsigned weight) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Tenant& t = tenantLocked(tenant);
+    t.weight = std::max(weight, 1u);
+    t.deficit = std::min(t.deficit, t.weight);
+    return false;
+}
+
+bool TenantScheduler::setConcurrencyLimit(TenantId tenant, size_t maxRunning) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Tenant& t = tenantLocked(tenant);
+    t.limit = maxRunning;
+    if (t.linked && !t.runnable()) {
+        unlink(t);
+        t.deficit = 0;
+        return false;
+    }
+    return relinkLocked(t);
+}
+
+TenantStats TenantScheduler::stats(TenantId tenant) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = tenants.find(tenant);
+    if (it == tenants.end()) {
+        return {};
+    }
+    TenantStats s = it->second->stats;
+    s.queued = it->second->tasks.size();
+    s.running = it->second->running;
+    return s;
+}
+
+TenantScheduler::Tenant& TenantScheduler::tenantLocked(TenantId tenant) {
+    std::unique_ptr<Tenant>& slot = tenants[tenant];
+    if (!slot) {
+        slot = std::make_unique<Tenant>();
+        slot->id = tenant;
+    }
+    return *slot;
+}
+
+bool TenantScheduler::relinkLocked(Tenant& t) {
+    if (t.linked || !t.runnable()) {
+        return false;
+    }
+    link(t);
+    return true;
+}
+
+void TenantScheduler::link(Tenant& t) {
+    t.prev = tail;
+    t.next = nullptr;
+    if (tail) {
+        tail->next = &t;
+    } else {
+        head = &t;
+    }
+    tail = &t;
+    t.linked = true;
+    runnableTenants.fetch_add(1, std::memory_order_seq_cst);
+}
+
+void TenantScheduler::unlink(Tenant& t) {
+    if (t.prev) {
+        t.prev->next = t.next;
+    } else {
+        head = t.next;
+    }
+    if (t.next) {
+        t.next->prev = t.prev;
+    } else {
+        tail = t.prev;
+    }
+    t.prev = t.next = nullptr;
+    t.linked = false;
+    runnableTenants.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+} // namespace MB
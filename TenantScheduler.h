@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+
+namespace MB {
+
+using TenantId = uint32_t;
+
+struct TenantStats {
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    size_t queued = 0;
+    size_t running = 0;
+    std::chrono::nanoseconds busyTime{0}; // Summed task execution time
+};
+
+// Deficit round robin across per-tenant FIFO queues. Each tenant with
+// runnable work sits in a ring; the head tenant gets `weight` tasks per
+// turn, then moves to the tail. Tenants at their concurrency limit leave the
+// ring until one of their tasks completes. Every operation is O(1), however
+// many tenants there are.
+class TenantScheduler {
+public:
+    TenantScheduler() = default;
+    TenantScheduler(const TenantScheduler&) = delete;
+    TenantScheduler& operator=(const TenantScheduler&) = delete;
+
+    // Each returns true when the tenant just became runnable, i.e. a worker
+    // may need waking.
+    bool push(TenantId tenant, std::function<void()> task);
+    bool complete(TenantId tenant, std::chrono::nanoseconds elapsed);
+    bool setWeight(TenantId tenant, unsigned weight);            // Tasks per turn, >= 1
+    bool setConcurrencyLimit(TenantId tenant, size_t maxRunning); // 0 = unlimited
+
+    bool tryPop(std::function<void()>& task, TenantId& tenant);
+
+    bool hasRunnable() const { return runnableTenants.load(std::memory_order_seq_cst) > 0; }
+    size_t queuedCount() const { return queued.load(std::memory_order_relaxed); }
+    TenantStats stats(TenantId tenant) const;
+
+private:
+    struct Tenant {
+        TenantId id = 0;
+        std::queue<std::function<void()>> tasks;
+        unsigned weight = 1;
+        unsigned deficit = 0;
+        size_t limit = 0;
+        size_t running = 0;
+        TenantStats stats;
+
+        // Intrusive links for the ring of runnable tenants
+        bool linked = false;
+        Tenant* prev = nullptr;
+        Tenant* next = nullptr;
+
+        bool runnable() const { return !tasks.empty() && (limit == 0 || running < limit); }
+    };
+
+    Tenant& tenantLocked(TenantId tenant);
+    bool relinkLocked(Tenant& t);
+    void link(Tenant& t);
+    void unlink(Tenant& t);
+
+    mutable std::mutex mutex;
+    std::unordered_map<TenantId, std::unique_ptr<Tenant>> tenants;
+    Tenant* head = nullptr;
+    Tenant* tail = nullptr;
+    std::atomic<size_t> runnableTenants = 0;
+    std::atomic<size_t> queued = 0;
+};
+
+} // namespace MB
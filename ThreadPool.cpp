@@ -1,67 +1,930 @@
 #include "ThreadPool.h"
+#include "Epoch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace MB {
 
-ThreadPool::ThreadPool(size_t initialThreads, size_t maxThreads)
-    : maxThreads(maxThreads) {
-    for (size_t i = 0; i < initialThreads; ++i) {
-        addThread();
-    }
+ThreadPool::ThreadPool(size_t initialThreads, size_t maxThreads,
+                       WorkerHook onWorkerStart, WorkerHook onWorkerStop)
+    : ThreadPool(initialThreads, maxThreads, ThreadOptions{},
+                 std::move(onWorkerStart), std::move(onWorkerStop)) {}
+
+ThreadPool::ThreadPool(size_t initialThreads, size_t maxThreads, ThreadOptions threadOptions,
+                       WorkerHook onWorkerStart, WorkerHook onWorkerStop)
+    : ThreadPool(initialThreads, maxThreads, QueueBackend::Mutex, std::move(threadOptions),
+                 std::move(onWorkerStart), std::move(onWorkerStop)) {}
+
+ThreadPool::ThreadPool(size_t initialThreads, size_t maxThreads, QueueBackend queueBackend,
+                       ThreadOptions threadOptions, WorkerHook onWorkerStart,
+                       WorkerHook onWorkerStop)
+    : maxThreads(maxThreads),
+      threadOptions(std::move(threadOptions)),
+      onWorkerStart(std::move(onWorkerStart)),
+      onWorkerStop(std::move(onWorkerStop)),
+      workers(maxThreads),
+      injection(makeTaskQueue(queueBackend)) {
+    resize(initialThreads);
 }
 
 ThreadPool::~ThreadPool() {
+    // Release delayed work while the workers are still there to run it
+    shuttingDown = true;
+    timers.shutdown();
+
     stop = true;
-    condition.notify_all();
-    for (std::thread &worker : workers) {
-        if (worker.joinable()) {
-            worker.join();
+    // Wake a single sleeper and a single parked worker; each one passes the
+    // wakeup on as it leaves, so shutdown never stampedes the queue lock.
+    wakeup.notify();
+    {
+        // Parked workers come back to help drain the queue before exiting
+        std::unique_lock<std::mutex> lock(workersMutex);
+        wakeNextParked(0);
+    }
+    for (size_t i = 0; i < workerCount; ++i) {
+        if (workers[i]->thread.joinable()) {
+            workers[i]->thread.join();
         }
     }
 }
 
-void ThreadPool::workerLoop() {
+thread_local ThreadPool::Worker* ThreadPool::currentWorker = nullptr;
+
+size_t ThreadPool::workerIndex() const {
+    Worker* self = currentWorker;
+    return self && self->owner == this ? self->index : npos;
+}
+
+size_t ThreadPool::currentWorkerIndex() {
+    Worker* self = currentWorker;
+    return self ? self->index : npos;
+}
+
+void ThreadPool::workerLoop(Worker& self) {
+    currentWorker = &self;
+    epoch::online();
+
+    std::string name;
+    if (!threadOptions.namePrefix.empty()) {
+        // Shorten the prefix, not the index, to fit Linux's 15-char limit
+        char buffer[16];
+        int suffix = std::snprintf(nullptr, 0, "-%zu", self.index);
+        int prefix = std::max(0, static_cast<int>(sizeof(buffer)) - 1 - suffix);
+        std::snprintf(buffer, sizeof(buffer), "%.*s-%zu", prefix,
+                      threadOptions.namePrefix.c_str(), self.index);
+        name = buffer;
+    }
+    applyThreadOptions(threadOptions, name);
+
+    if (onWorkerStart) {
+        onWorkerStart(self.index);
+    }
+    bool woken = false;
     while (true) {
+        // A parked or paused worker must not sit on tasks others can't see
+        if (!stop && (paused || self.retire)) {
+            flushLocal(self);
+        }
+
+        if (self.retire && !stop) {
+            // Retired while asleep: the wakeup that got us here may have
+            // been meant for queued work, so pass it to a worker that stays
+            if (woken && hasWork(self)) {
+                wakeup.notify();
+            }
+            woken = false;
+            epoch::offline();
+            park(self);
+            epoch::online();
+            continue;
+        }
+
         std::function<void()> task;
-        {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            condition.wait(lock, [this] { return stop || !tasks.empty(); });
+        if (!paused || stop) {
+            task = findTask(self);
+        }
+        if (task) {
+            // Chained wakeup: a worker that was just woken wakes one more
+            // only if work is still waiting, instead of everyone at once
+            if (woken && hasWork(self)) {
+                wakeup.notify();
+            }
+            woken = false;
+            if (prefetchHints.load(std::memory_order_relaxed)) {
+                prefetchNext(self);
+            }
+            runTask(self, task);
+            // Between tasks nothing here holds a lock-free node
+            epoch::quiescent();
+            continue;
+        }
 
-            if (stop && tasks.empty()) {
+        // Once stopping, every worker drains regardless of pause/retire
+        if (stop) {
+            if (!hasWork(self)) {
+                wakeup.notify(); // Pass the shutdown along the chain
+                if (onWorkerStop) {
+                    onWorkerStop(self.index);
+                }
+                epoch::offline();
                 return;
             }
+            continue; // Work is sitting in a peer's queue; go steal it
+        }
+
+        // Woken but not taking work (paused/retiring): hand the wakeup on
+        if (woken && hasWork(self)) {
+            wakeup.notify();
+        }
+
+        // Flagged before the final check, so a peer that sees us awake
+        // knows we will still see tasks routed to us
+        self.sleeping.store(true, std::memory_order_seq_cst);
+        EventCount::Key key = wakeup.prepareWait();
+        if (stop || self.retire || (!paused && hasWork(self))) {
+            wakeup.cancelWait();
+        } else {
+            // Sleeping workers must not hold back reclamation
+            epoch::offline();
+            wakeup.commitWait(key);
+            epoch::online();
+            woken = true;
+        }
+        self.sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+static int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void ThreadPool::runTask(Worker& self, std::function<void()>& task) {
+    // Owner-only writes: plain stores, no RMW on the task path
+    self.tasksStarted.store(self.tasksStarted.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+    self.taskStart.store(steadyNowNs(), std::memory_order_relaxed);
+    task();
+    self.taskStart.store(0, std::memory_order_relaxed);
+}
+
+namespace {
+
+// The callable enqueue(task, hint) stores; workers find the hint again
+// through std::function::target()
+struct HintedTask {
+    std::function<void()> task;
+    PrefetchHint hint;
+
+    void operator()() { task(); }
+};
+
+void prefetchRange(const PrefetchHint& hint) {
+    constexpr size_t kLine = 64;
+    // More than this would evict itself from L2 before the task gets to it
+    constexpr size_t kMaxPrefetchBytes = 64 * 1024;
+    constexpr size_t kAdviseBytes = 1024 * 1024;
+
+    const char* data = static_cast<const char*>(hint.data);
+#if defined(__unix__) || defined(__APPLE__)
+    if (hint.size >= kAdviseBytes) {
+        // Page-aligned start; failures (e.g. not a mapping) are harmless
+        static const uintptr_t pageMask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+        uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~pageMask;
+        uintptr_t end = reinterpret_cast<uintptr_t>(data) + hint.size;
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+    }
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+    size_t size = std::min(hint.size, kMaxPrefetchBytes);
+    for (size_t offset = 0; offset < size; offset += kLine) {
+        __builtin_prefetch(data + offset, 0, 3);
+    }
+#else
+    (void)data;
+    (void)kLine;
+    (void)kMaxPrefetchBytes;
+    (void)kAdviseBytes;
+#endif
+}
+
+} // namespace
+
+void ThreadPool::prefetchNext(Worker& self) {
+    // Only owner-side queues: the lifo slot runs next if set, else the
+    // bottom of the local deque. Thieves retire stolen nodes through the
+    // epoch and never write the hint, so reading one that is being stolen
+    // meanwhile stays safe.
+    PrefetchHint hint;
+    if (self.lifoSlot) {
+        if (const HintedTask* hinted = self.lifoSlot.target<HintedTask>()) {
+            hint = hinted->hint;
+        }
+    } else if (const LocalTask* next = self.local.peek()) {
+        hint = next->hint;
+    }
+    if (hint.data && hint.size > 0) {
+        prefetchRange(hint);
+    }
+}
+
+ThreadPool::LocalTask* ThreadPool::makeLocalTask(std::function<void()> task) const {
+    PrefetchHint hint;
+    if (prefetchHints.load(std::memory_order_relaxed)) {
+        if (const HintedTask* hinted = task.target<HintedTask>()) {
+            hint = hinted->hint;
+        }
+    }
+    return new LocalTask{std::move(task), hint};
+}
+
+std::function<void()> ThreadPool::findTask(Worker& self) {
+    std::function<void()> task;
+
+    if (self.lifoSlot) {
+        if (self.lifoRuns < kLifoBudget) {
+            ++self.lifoRuns;
+            task = std::move(self.lifoSlot);
+            self.lifoSlot = nullptr;
+            self.localPending.store(0, std::memory_order_relaxed);
+            return task;
+        }
+        // Budget spent: requeue behind everyone else
+        pushGlobal(std::move(self.lifoSlot));
+        self.lifoSlot = nullptr;
+        self.localPending.store(0, std::memory_order_relaxed);
+    }
+    self.lifoRuns = 0;
+
+    if (++self.tick % kGlobalPollInterval == 0 && tryPopShared(self, task)) {
+        return task;
+    }
 
-            task = std::move(tasks.front());
-            tasks.pop();
+    if (LocalTask* local = self.local.pop()) {
+        task = std::move(local->task);
+        delete local;
+        return task;
+    }
+
+    if (self.inboxSize.load(std::memory_order_relaxed) > 0 && tryPopInbox(self, task)) {
+        return task;
+    }
+
+    if (tryPopShared(self, task)) {
+        return task;
+    }
+
+    // Steal from peers, starting after ourselves to spread the thieves out
+    size_t count = workerCount.load(std::memory_order_acquire);
+    for (size_t i = 1; i < count; ++i) {
+        Worker& victim = *workers[(self.index + i) % count];
+        if (LocalTask* stolen = victim.local.steal()) {
+            task = std::move(stolen->task);
+            // The owner may be peeking at it for a prefetch hint
+            epoch::retire(stolen);
+            return task;
+        }
+    }
+    for (size_t i = 1; i < count; ++i) {
+        Worker& victim = *workers[(self.index + i) % count];
+        if (inboxStealable(victim) && tryPopInbox(victim, task)) {
+            return task;
+        }
+    }
+    return task;
+}
+
+bool ThreadPool::tryPopShared(Worker& self, std::function<void()>& task) {
+    // Rotate which shared source goes first so untagged work, the tenant
+    // queues and cost-tagged work can't starve one another
+    switch (self.tick % 3) {
+    case 0:
+        return tryPopGlobal(self, task) || tryPopTenant(task) || tryPopTagged(task);
+    case 1:
+        return tryPopTenant(task) || tryPopTagged(task) || tryPopGlobal(self, task);
+    default:
+        return tryPopTagged(task) || tryPopGlobal(self, task) || tryPopTenant(task);
+    }
+}
+
+bool ThreadPool::tryPopTenant(std::function<void()>& task) {
+    if (!tenants.hasRunnable()) {
+        return false;
+    }
+    std::function<void()> inner;
+    TenantId tenant = 0;
+    if (!tenants.tryPop(inner, tenant)) {
+        return false;
+    }
+    task = [this, tenant, inner = std::move(inner)] {
+        auto start = std::chrono::steady_clock::now();
+        inner();
+        // A tenant at its concurrency limit may have just become runnable
+        if (tenants.complete(tenant, std::chrono::steady_clock::now() - start)) {
+            wakeup.notify();
+        }
+    };
+    return true;
+}
+
+bool ThreadPool::tryPopTagged(std::function<void()>& task) {
+    if (!costs.hasQueued()) {
+        return false;
+    }
+    std::function<void()> inner;
+    TaskTag tag = 0;
+    if (!costs.tryPop(inner, tag)) {
+        return false;
+    }
+    task = [this, tag, inner = std::move(inner)] {
+        auto start = std::chrono::steady_clock::now();
+        inner();
+        costs.record(tag, std::chrono::steady_clock::now() - start);
+    };
+    return true;
+}
+
+bool ThreadPool::tryPopGlobal(Worker& self, std::function<void()>& task) {
+    size_t queued = injection->size();
+    if (queued == 0) {
+        return false;
+    }
+    // Take a fair share of the backlog per acquisition: enough to amortise
+    // the handoff, not so much that peers sit idle
+    size_t share = queued / std::max<size_t>(activeWorkers, 1);
+    size_t batch = std::clamp<size_t>(share, 1, maxDequeueBatch);
+    if (injection->popBatch(self.batch, batch) == 0) {
+        return false;
+    }
+    task = std::move(self.batch.front());
+    if (self.batch.size() == 1) {
+        self.batch.clear();
+        return true;
+    }
+
+    // The rest go to the local deque, newest first so the owner pops them
+    // in queue order and idle peers can steal the leftovers
+    for (auto it = self.batch.rbegin(); it + 1 != self.batch.rend(); ++it) {
+        self.local.push(makeLocalTask(std::move(*it)));
+    }
+    self.batch.clear();
+    wakeup.notify();
+    return true;
+}
+
+bool ThreadPool::hasWork(const Worker& self) const {
+    return injection->size() > 0 || tenants.hasRunnable() || costs.hasQueued() ||
+           self.inboxSize.load(std::memory_order_seq_cst) > 0 ||
+           hasStealableWork();
+}
+
+bool ThreadPool::hasStealableWork() const {
+    size_t count = workerCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (!workers[i]->local.empty() || inboxStealable(*workers[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::inboxStealable(const Worker& victim) const {
+    size_t queued = victim.inboxSize.load(std::memory_order_seq_cst);
+    if (queued == 0) {
+        return false;
+    }
+    // Leave a busy worker its own tasks unless it is falling behind
+    return queued > affinityStealThreshold.load(std::memory_order_relaxed) ||
+           victim.sleeping.load(std::memory_order_seq_cst) || victim.retire || stop;
+}
+
+bool ThreadPool::tryPopInbox(Worker& victim, std::function<void()>& task) {
+    std::unique_lock<std::mutex> lock(victim.inboxMutex);
+    if (victim.inbox.empty()) {
+        return false;
+    }
+    task = std::move(victim.inbox.front());
+    victim.inbox.pop_front();
+    victim.inboxSize.store(victim.inbox.size(), std::memory_order_relaxed);
+    return true;
+}
+
+void ThreadPool::park(Worker& self) {
+    std::unique_lock<std::mutex> lock(workersMutex);
+    self.isParked = true;
+    self.parked.wait(lock, [this, &self] { return stop || !self.retire; });
+    self.isParked = false;
+    if (stop) {
+        wakeNextParked(self.index + 1);
+    }
+}
+
+void ThreadPool::wakeNextParked(size_t from) {
+    // Caller holds workersMutex
+    for (size_t i = from; i < workerCount; ++i) {
+        if (workers[i]->isParked) {
+            workers[i]->parked.notify_one();
+            return;
         }
-        // Execute the task outside the lock
-        task();
     }
 }
 
 void ThreadPool::addThread() {
-    // Lock to safely modify the workers vector
-    std::unique_lock<std::mutex> lock(queueMutex);
-    if (workers.size() < maxThreads) {
-        workers.emplace_back([this] { this->workerLoop(); });
+    // Caller holds workersMutex
+    size_t index = workerCount;
+    if (index < maxThreads) {
+        auto worker = std::make_unique<Worker>();
+        worker->index = index;
+        worker->owner = this;
+        Worker* self = worker.get();
+        workers[index] = std::move(worker);
+        workerCount.store(index + 1, std::memory_order_release);
+        ++activeWorkers;
+        self->thread.start([this, self] { this->workerLoop(*self); }, threadOptions.stackSize);
     }
 }
 
 void ThreadPool::enqueue(std::function<void()> task) {
+    Worker* self = currentWorker;
+    if (self && self->owner == this) {
+        if (lifoEnabled) {
+            // Run the follow-up next on this (cache-warm) worker; whatever
+            // it displaces goes to the local queue
+            std::swap(task, self->lifoSlot);
+            self->localPending.store(1, std::memory_order_relaxed);
+            if (!task) {
+                return;
+            }
+        }
+        if (localQueueEnabled) {
+            pushLocal(*self, std::move(task));
+            return;
+        }
+    }
+    pushGlobal(std::move(task));
+}
+
+void ThreadPool::pushLocal(Worker& self, std::function<void()> task) {
+    self.local.push(makeLocalTask(std::move(task)));
+    // Free unless some worker is idle and could steal this
+    wakeup.notify();
+}
+
+void ThreadPool::enqueue(TenantId tenant, std::function<void()> task) {
+    tenants.push(tenant, std::move(task));
+    wakeup.notify();
+}
+
+void ThreadPool::setTenantWeight(TenantId tenant, unsigned weight) {
+    tenants.setWeight(tenant, weight);
+}
+
+void ThreadPool::setTenantConcurrencyLimit(TenantId tenant, size_t maxRunning) {
+    if (tenants.setConcurrencyLimit(tenant, maxRunning)) {
+        wakeup.notify();
+    }
+}
+
+TenantStats ThreadPool::getTenantStats(TenantId tenant) const {
+    return tenants.stats(tenant);
+}
+
+// Jump consistent hash (Lamping and Veach): growing from n to n + 1
+// buckets moves only 1/(n + 1) of the keys, all of them to the new bucket.
+static size_t jumpHash(uint64_t key, size_t buckets) {
+    int64_t bucket = -1;
+    int64_t next = 0;
+    while (next < static_cast<int64_t>(buckets)) {
+        bucket = next;
+        key = key * 2862933555777941757ULL + 1;
+        next = static_cast<int64_t>((bucket + 1) *
+                                    (double(int64_t(1) << 31) / double((key >> 33) + 1)));
+    }
+    return static_cast<size_t>(bucket);
+}
+
+void ThreadPool::enqueue(std::function<void()> task, uint64_t affinityKey) {
+    size_t count = workerCount.load(std::memory_order_acquire);
+    if (count == 0) {
+        pushGlobal(std::move(task));
+        return;
+    }
+    // Workers retire from the top, so the active ones are the low indices
+    size_t active = std::clamp<size_t>(activeWorkers, 1, count);
+    Worker& target = *workers[jumpHash(affinityKey, active)];
     {
-        std::unique_lock<std::mutex> lock(queueMutex);
-        tasks.push(std::move(task));
+        std::unique_lock<std::mutex> lock(target.inboxMutex);
+        target.inbox.push_back(std::move(task));
+        target.inboxSize.store(target.inbox.size(), std::memory_order_seq_cst);
+    }
+    wakeup.notify();
+}
+
+void ThreadPool::setAffinityStealThreshold(size_t tasks) {
+    affinityStealThreshold = tasks;
+}
+
+void ThreadPool::enqueue(std::function<void()> task, PrefetchHint hint) {
+    prefetchHints.store(true, std::memory_order_relaxed);
+    enqueue(std::function<void()>(HintedTask{std::move(task), hint}));
+}
+
+void ThreadPool::enqueueTagged(TaskTag tag, std::function<void()> task) {
+    costs.push(tag, std::move(task));
+    wakeup.notify();
+}
+
+void ThreadPool::setShortestJobFirst(bool enabled, std::chrono::nanoseconds starvationLimit) {
+    costs.setShortestFirst(enabled, starvationLimit);
+}
+
+std::chrono::nanoseconds ThreadPool::getExpectedCost(TaskTag tag) const {
+    return costs.expectedCost(tag);
+}
+
+void ThreadPool::enqueueAfter(std::chrono::nanoseconds delay, std::function<void()> task) {
+    timers.schedule(TimerQueue::Clock::now() + delay,
+                     [this, task = std::move(task)]() mutable { enqueue(std::move(task)); });
+}
+
+void ThreadPool::enqueueBulk(std::vector<std::function<void()>> batch) {
+    if (batch.empty()) {
+        return;
+    }
+    injection->pushBulk(batch);
+    // One wakeup; the woken worker chains to the next while work remains
+    wakeup.notify();
+}
+
+namespace {
+
+// Shared with the helper tasks, which may still be queued (e.g. behind a
+// pause) after the region they were meant for has finished without them
+struct RegionState {
+    static constexpr size_t kClosed = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+    // Helpers that have joined; kClosed once the caller has fixed the
+    // participant count, after which later helpers leave without running
+    std::atomic<size_t> joined = 0;
+    std::atomic<bool> started = false;
+    std::atomic<size_t> finished = 0;
+    std::optional<Barrier> barrier;
+};
+
+// Set while this thread runs a region body, so a nested region runs inline
+// instead of waiting on the region it is part of
+thread_local bool inRegion = false;
+
+void runRegionBody(const std::function<void(size_t, Barrier&)>& body, size_t tid,
+                   Barrier& barrier) {
+    bool outer = inRegion;
+    inRegion = true;
+    body(tid, barrier);
+    inRegion = outer;
+}
+
+} // namespace
+
+void ThreadPool::parallelRegion(size_t nthreads,
+                                const std::function<void(size_t tid, Barrier& barrier)>& body) {
+    Worker* self = currentWorker;
+    bool onPool = self && self->owner == this;
+
+    // One region at a time. A worker must not block on this: the region
+    // holding it may be waiting for that worker to join.
+    std::unique_lock<std::mutex> region(regionMutex, std::defer_lock);
+    if (inRegion) {
+        // Nested: the helpers are all taken by the region we are part of
+    } else if (onPool) {
+        region.try_lock();
+    } else {
+        region.lock();
     }
-    condition.notify_one();
+    size_t helpers = 0;
+    if (region.owns_lock() && !paused) {
+        std::unique_lock<std::mutex> lock(workersMutex);
+        size_t others = activeWorkers - (onPool && !self->retire ? 1 : 0);
+        helpers = std::min(std::max<size_t>(nthreads, 1) - 1, others);
+        if (helpers > 0) {
+            // Keep resize() from parking the workers the helpers are
+            // counting on until the region is over
+            regionReserved = helpers + (onPool ? 1 : 0);
+        }
+    }
+    if (helpers == 0) {
+        if (region.owns_lock()) {
+            region.unlock();
+        }
+        Barrier solo(1);
+        runRegionBody(body, 0, solo);
+        return;
+    }
+
+    auto state = std::make_shared<RegionState>();
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(helpers);
+    for (size_t i = 0; i < helpers; ++i) {
+        tasks.push_back([state, &body] {
+            size_t ticket = state->joined.fetch_add(1, std::memory_order_acq_rel);
+            if (ticket & RegionState::kClosed) {
+                return; // The region started without us
+            }
+            while (!state->started.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            runRegionBody(body, ticket + 1, *state->barrier);
+            state->finished.fetch_add(1, std::memory_order_release);
+        });
+    }
+    // Shared queue even from a worker, so idle peers pick the helpers up
+    enqueueBulk(std::move(tasks));
+
+    // Start once every helper is running. A pause stops further helpers from
+    // being picked up, so go ahead with the ones we have instead.
+    while (state->joined.load(std::memory_order_acquire) < helpers && !paused) {
+        std::this_thread::yield();
+    }
+    size_t joined = state->joined.fetch_or(RegionState::kClosed, std::memory_order_acq_rel);
+    joined = std::min(joined, helpers);
+    state->barrier.emplace(joined + 1);
+    state->started.store(true, std::memory_order_release);
+
+    runRegionBody(body, 0, *state->barrier);
+    // body is ours; wait until no joined helper can still touch it
+    while (state->finished.load(std::memory_order_acquire) < joined) {
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(workersMutex);
+    regionReserved = 0;
+    applySize();
+}
+
+void ThreadPool::pushGlobal(std::function<void()> task) {
+    injection->push(std::move(task));
+    wakeup.notify();
+}
+
+void ThreadPool::flushLocal(Worker& self) {
+    if (self.lifoSlot) {
+        self.batch.push_back(std::move(self.lifoSlot));
+        self.lifoSlot = nullptr;
+        self.localPending.store(0, std::memory_order_relaxed);
+    }
+    // Oldest first, so the shared queue keeps submission order
+    while (LocalTask* local = self.local.steal()) {
+        self.batch.push_back(std::move(local->task));
+        delete local;
+    }
+    if (self.inboxSize.load(std::memory_order_relaxed) > 0) {
+        std::unique_lock<std::mutex> lock(self.inboxMutex);
+        for (auto& task : self.inbox) {
+            self.batch.push_back(std::move(task));
+        }
+        self.inbox.clear();
+        self.inboxSize.store(0, std::memory_order_relaxed);
+    }
+    if (self.batch.empty()) {
+        return;
+    }
+    injection->pushBulk(self.batch);
+    self.batch.clear();
+    wakeup.notify();
+}
+
+void ThreadPool::setLifoSlotEnabled(bool enabled) {
+    lifoEnabled = enabled;
+}
+
+void ThreadPool::setLocalQueueEnabled(bool enabled) {
+    localQueueEnabled = enabled;
+}
+
+void ThreadPool::setMaxDequeueBatch(size_t maxTasks) {
+    maxDequeueBatch = std::max<size_t>(maxTasks, 1);
+}
+
+void ThreadPool::pause() {
+    paused = true;
+}
+
+void ThreadPool::resume() {
+    paused = false;
+    wakeup.notify();
+}
+
+void ThreadPool::resize(size_t activeThreads) {
+    std::unique_lock<std::mutex> lock(workersMutex);
+    targetThreads = std::min(activeThreads, maxThreads);
+    applySize();
+}
+
+bool ThreadPool::borrowThread() {
+    std::unique_lock<std::mutex> lock(workersMutex);
+    if (targetThreads + borrowedThreads >= maxThreads) {
+        return false;
+    }
+    ++borrowedThreads;
+    applySize();
+    return true;
+}
+
+void ThreadPool::returnThread() {
+    std::unique_lock<std::mutex> lock(workersMutex);
+    if (borrowedThreads > 0) {
+        --borrowedThreads;
+    }
+    applySize();
+}
+
+void ThreadPool::applySize() {
+    // Caller holds workersMutex
+    size_t activeThreads = std::max(std::min(targetThreads + borrowedThreads, maxThreads),
+                                    regionReserved);
+    size_t count = workerCount;
+    size_t active = activeWorkers;
+
+    // Retire the highest-indexed active workers first
+    for (size_t i = count; i-- > 0 && active > activeThreads;) {
+        if (!workers[i]->retire) {
+            workers[i]->retire = true;
+            --active;
+        }
+    }
+
+    // Reuse parked workers before creating new threads
+    for (size_t i = 0; i < count && active < activeThreads; ++i) {
+        if (workers[i]->retire) {
+            workers[i]->retire = false;
+            workers[i]->parked.notify_one();
+            ++active;
+        }
+    }
+    activeWorkers = active;
+
+    while (activeWorkers < activeThreads && workerCount < maxThreads) {
+        addThread();
+    }
+
+    // No wakeup needed: an idle retiring worker parks the next time it is
+    // woken, and first passes that wakeup on if there is work waiting (see
+    // the retire branch of workerLoop).
 }
 
 size_t ThreadPool::getThreadCount() const {
-    std::unique_lock<std::mutex> lock(queueMutex);
-    return workers.size();
+    return activeWorkers;
+}
+
+size_t ThreadPool::getParkedThreadCount() const {
+    std::unique_lock<std::mutex> lock(workersMutex);
+    return workerCount - activeWorkers;
 }
 
 size_t ThreadPool::getPendingTaskCount() const {
-    std::unique_lock<std::mutex> lock(queueMutex);
-    return tasks.size();
+    size_t pending = 0;
+    size_t count = workerCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        pending += workers[i]->localPending.load(std::memory_order_relaxed);
+        pending += workers[i]->local.size();
+        pending += workers[i]->inboxSize.load(std::memory_order_relaxed);
+    }
+    pending += tenants.queuedCount();
+    pending += costs.queuedCount();
+    return pending + injection->size();
+}
+
+bool ThreadPool::isPaused() const {
+    return paused;
+}
+
+void ThreadPool::enableWatchdog(WatchdogOptions options) {
+    {
+        std::unique_lock<std::mutex> lock(watchdogMutex);
+        watchdog = std::move(options);
+        watchdogEnabled = true;
+        ++watchdogGeneration;
+    }
+    armWatchdog();
+}
+
+void ThreadPool::disableWatchdog() {
+    std::unique_lock<std::mutex> lock(watchdogMutex);
+    watchdogEnabled = false;
+    ++watchdogGeneration;
+}
+
+void ThreadPool::armWatchdog() {
+    std::chrono::milliseconds interval;
+    uint64_t generation;
+    {
+        std::unique_lock<std::mutex> lock(watchdogMutex);
+        if (!watchdogEnabled || shuttingDown) {
+            return;
+        }
+        interval = watchdog.checkInterval;
+        generation = watchdogGeneration;
+    }
+    timers.schedule(TimerQueue::Clock::now() + interval, [this, generation] {
+        {
+            std::unique_lock<std::mutex> lock(watchdogMutex);
+            if (generation != watchdogGeneration) {
+                return; // Disabled or re-enabled since this was armed
+            }
+        }
+        checkWatchdog();
+        armWatchdog();
+    });
+}
+
+void ThreadPool::checkWatchdog() {
+    struct Stall {
+        size_t index;
+        std::chrono::nanoseconds runningFor;
+    };
+    std::vector<Stall> stalls;
+    std::function<void(size_t, std::chrono::nanoseconds)> onStall;
+    bool dumpStack = false;
+
+    int64_t now = steadyNowNs();
+    size_t stalledNow = 0;
+    {
+        std::unique_lock<std::mutex> lock(watchdogMutex);
+        auto threshold = std::chrono::duration_cast<std::chrono::nanoseconds>(watchdog.threshold);
+        size_t count = workerCount.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            Worker& w = *workers[i];
+            int64_t start = w.taskStart.load(std::memory_order_relaxed);
+            uint64_t task = w.tasksStarted.load(std::memory_order_relaxed);
+            bool stuck = start != 0 && now - start > threshold.count();
+
+            if (w.stalled && (!stuck || task != w.stalledTask)) {
+                // The flagged task finished: hand back any borrowed capacity
+                w.stalled = false;
+                if (w.replaced) {
+                    w.replaced = false;
+                    returnThread();
+                }
+            }
+            if (!stuck) {
+                continue;
+            }
+            ++stalledNow;
+            if (w.stalled) {
+                continue; // Already reported
+            }
+
+            w.stalled = true;
+            w.stalledTask = task;
+            stalls.push_back({i, std::chrono::nanoseconds(now - start)});
+            if (watchdog.replaceStalledWorkers) {
+                // maxThreads may leave nothing to borrow
+                w.replaced = borrowThread();
+            }
+        }
+        stalledWorkers = stalledNow;
+        if (!stalls.empty()) {
+            onStall = watchdog.onStall;
+            dumpStack = watchdog.dumpStack;
+        }
+    }
+
+    // Unlocked, so the callback may call back into the watchdog API and a
+    // slow one doesn't hold up the next check's bookkeeping
+    for (const Stall& stall : stalls) {
+        if (onStall) {
+            onStall(stall.index, stall.runningFor);
+        } else {
+            std::cerr << "[Watchdog] Worker " << stall.index << " has been running one task for "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(stall.runningFor).count()
+                      << " ms" << std::endl;
+        }
+        if (dumpStack) {
+            workers[stall.index]->thread.requestStackDump();
+        }
+    }
+}
+
+size_t ThreadPool::getStalledWorkerCount() const {
+    return stalledWorkers;
+}
+
+bool ThreadPool::isShuttingDown() const {
+    return shuttingDown;
+}
+
+uint64_t ThreadPool::getWakeupCount() const {
+    return wakeup.wakeCount();
 }
 
-} // namespace MB
\ No newline at end of file
+} // namespace MB
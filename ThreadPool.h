@@ -1,41 +1,315 @@
 #pragma once
 
 #include <vector>
+#include <deque>
 #include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <memory>
+
+#include "Barrier.h"
+#include "CostScheduler.h"
+#include "EventCount.h"
+#include "NativeThread.h"
+#include "TaskQueue.h"
+#include "TenantScheduler.h"
+#include "TimerQueue.h"
+#include "WorkStealingDeque.h"
 
 namespace MB {
 
+struct WatchdogOptions {
+    // A task running longer than this counts as stalled
+    std::chrono::milliseconds threshold{5000};
+    std::chrono::milliseconds checkInterval{1000};
+    // Have the stalled worker print its stack to stderr via SIGUSR2
+    // (Linux/glibc). Off by default: the first dump installs a process-wide
+    // SIGUSR2 handler for good (chaining to any earlier handler for signals
+    // it didn't send, and ignoring them if there was none), and a blocking
+    // call in the stalled task may see EINTR.
+    bool dumpStack = false;
+    // Start (or unpark) one extra worker per stalled one, on top of the
+    // size set with resize(), and give it back once the stalled task
+    // finishes. Bounded by maxThreads.
+    bool replaceStalledWorkers = false;
+    // Called once per stalled task from the timer thread, without any pool
+    // lock held, so it may call enableWatchdog() and friends. The default
+    // prints a line to stderr.
+    std::function<void(size_t workerIndex, std::chrono::nanoseconds runningFor)> onStall;
+};
+
+// Memory a task is about to read. A worker that knows which task it runs
+// next prefetches that task's range while running the current one.
+struct PrefetchHint {
+    const void* data = nullptr;
+    size_t size = 0;
+};
+
 class ThreadPool {
 public:
-    ThreadPool(size_t initialThreads, size_t maxThreads);
+    // Called on the worker thread with its index (0..maxThreads-1): onWorkerStart
+    // before its first task, onWorkerStop after its last one at shutdown.
+    using WorkerHook = std::function<void(size_t workerIndex)>;
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    ThreadPool(size_t initialThreads, size_t maxThreads,
+               WorkerHook onWorkerStart = {}, WorkerHook onWorkerStop = {});
+    // Workers are created with the given name prefix, scheduling class and
+    // stack size, e.g. {"ingest", SchedulingPolicy::Batch} or a 256 KB stack
+    // for pools with thousands of threads.
+    ThreadPool(size_t initialThreads, size_t maxThreads, ThreadOptions threadOptions,
+               WorkerHook onWorkerStart = {}, WorkerHook onWorkerStop = {});
+    // Selects the shared queue implementation. FlatCombining, PerCpu and
+    // Segmented pay off when many threads submit at once; Mutex (the
+    // default) is cheaper otherwise. All keep external submissions in FIFO
+    // order except PerCpu, which only keeps order per CPU.
+    ThreadPool(size_t initialThreads, size_t maxThreads, QueueBackend queueBackend,
+               ThreadOptions threadOptions = {},
+               WorkerHook onWorkerStart = {}, WorkerHook onWorkerStop = {});
     ~ThreadPool();
 
     // Deleted copy and move constructors for simplicity
     ThreadPool(const ThreadPool&) = delete;
     ThreadPool& operator=(const ThreadPool&) = delete;
 
+    // From outside the pool this goes through the shared queue. From one of
+    // the pool's own workers it stays on that worker without taking a lock.
+    // With the LIFO slot enabled (see setLifoSlotEnabled), a task must not
+    // block waiting on work it enqueued itself.
     void enqueue(std::function<void()> task);
 
+    // Tasks with the same key go to the same worker (by consistent hashing
+    // over the active workers), so data they share stays in that worker's
+    // cache. Other workers only take them when that worker is asleep,
+    // parked, or has more than the steal threshold (default 16) waiting.
+    void enqueue(std::function<void()> task, uint64_t affinityKey);
+    void setAffinityStealThreshold(size_t tasks);
+
+    // Submission with the range the task will read. Queued like enqueue(task);
+    // the hint only pays off when the task is queued behind another on the
+    // same worker (batched dequeue, tasks enqueued from a worker). Ranges of
+    // 1 MB and up also get madvise(MADV_WILLNEED), for cold file mappings.
+    void enqueue(std::function<void()> task, PrefetchHint hint);
+
+    // Tenant-tagged submission. Tenants share the workers by deficit round
+    // robin: each gets `weight` tasks per turn (default 1) and at most
+    // `maxRunning` tasks executing at once (default unlimited), so one
+    // flooding tenant can't starve the rest.
+    void enqueue(TenantId tenant, std::function<void()> task);
+    void setTenantWeight(TenantId tenant, unsigned weight);
+    void setTenantConcurrencyLimit(TenantId tenant, size_t maxRunning);
+    TenantStats getTenantStats(TenantId tenant) const;
+
+    // Cost-tagged submission. The pool keeps a moving average of each tag's
+    // execution time; with shortest-job-first on, queued tagged tasks with
+    // the lowest expected cost run first, except that any tagged task
+    // waiting longer than starvationLimit goes next. Off by default, in
+    // which case tagged tasks run in submission order.
+    void enqueueTagged(TaskTag tag, std::function<void()> task);
+    void setShortestJobFirst(bool enabled,
+                             std::chrono::nanoseconds starvationLimit = std::chrono::milliseconds(100));
+    std::chrono::nanoseconds getExpectedCost(TaskTag tag) const;
+
+    // Enqueue `task` once `delay` has passed. The timer thread only starts on
+    // first use; timers still pending at shutdown fire immediately.
+    void enqueueAfter(std::chrono::nanoseconds delay, std::function<void()> task);
+
+    // Queue many tasks under one lock acquisition. Only one worker is woken;
+    // each woken worker wakes the next while work remains.
+    void enqueueBulk(std::vector<std::function<void()>> batch);
+
+    // Runs body(tid, barrier) for tid 0..n-1 at the same time, the calling
+    // thread as tid 0 and the rest on workers, and returns once all are
+    // done. Bodies loop over their phases and call barrier.wait() between
+    // them, so one region replaces a round of enqueue-and-wait per phase and
+    // workers stay hot throughout. Bodies read the actual participant count
+    // from barrier.participants(), which is clamped as follows:
+    //  - to the caller plus the other active workers;
+    //  - regions run one at a time: another caller blocks until the current
+    //    region is done, except on a worker, where it runs body alone (n = 1)
+    //    rather than hold up a worker the current region may be waiting for;
+    //  - on a paused pool, and when called from inside a region body, body
+    //    runs alone on the caller;
+    //  - no body starts until every helper is running on a worker. Workers
+    //    busy with other tasks delay the start; if the pool is paused before
+    //    all helpers are running, the region goes ahead with those that are.
+    // While a region runs, resize() does not park the workers it counts on.
+    // body must not throw.
+    void parallelRegion(size_t nthreads, const std::function<void(size_t tid, Barrier& barrier)>& body);
+
+    // Stop handing out tasks; running tasks finish, new ones keep queueing.
+    void pause();
+    void resume();
+
+    // Change the number of active workers (clamped to maxThreads).
+    // Shrinking parks the extra workers once their current task is done,
+    // growing wakes parked workers before starting new threads. Workers the
+    // watchdog has added for stalled tasks come on top of this count.
+    void resize(size_t activeThreads);
+
+    // Tasks enqueued from a worker go to that worker's "next task" slot
+    // and run right after the current task (off by default). Pays off for
+    // message-passing chains where each task enqueues one follow-up. A task
+    // must not block waiting on work it enqueued itself while this is
+    // enabled: the follow-up sits in a slot only this worker runs.
+    void setLifoSlotEnabled(bool enabled);
+
+    // Tasks enqueued from a worker go to its lock-free local queue, where
+    // idle workers can steal them (on by default). When disabled they take
+    // the shared queue like any external submission.
+    void setLocalQueueEnabled(bool enabled);
+
+    // Upper bound on tasks a worker moves out of the shared queue per lock
+    // acquisition (default 32, 1 disables batching). The actual batch is the
+    // worker's share of the current backlog; extras land in its local queue
+    // where idle workers can steal them back.
+    void setMaxDequeueBatch(size_t maxTasks);
+
+    // Periodically check each worker's heartbeat for tasks running past
+    // options.threshold. Calling again replaces the options.
+    void enableWatchdog(WatchdogOptions options = {});
+    void disableWatchdog();
+
+    // Index of the calling worker thread, or npos off the pool's threads.
+    // Indices are stable for the life of a worker, parked or not.
+    size_t workerIndex() const;
+    // Same, for whichever pool the calling thread belongs to
+    static size_t currentWorkerIndex();
+
     // Safe way to get stats
     size_t getThreadCount() const;
+    size_t getParkedThreadCount() const;
     size_t getPendingTaskCount() const;
+    bool isPaused() const;
+    // True once the destructor has started
+    bool isShuttingDown() const;
+    // Workers currently running a task the watchdog flagged as stalled
+    size_t getStalledWorkerCount() const;
+    // Times an idle worker actually had to be woken through the kernel
+    uint64_t getWakeupCount() const;
 
 private:
+    // Local deque node. A hinted task's hint is copied out at push, so the
+    // owner can read it while a thief moves the task out.
+    struct LocalTask {
+        std::function<void()> task;
+        PrefetchHint hint;
+    };
+
+    struct Worker {
+        size_t index = 0;
+        NativeThread thread;
+        std::atomic<bool> retire = false;   // Park after the current task
+        std::condition_variable parked;     // Waited on with workersMutex
+        bool isParked = false;              // Guarded by workersMutex
+        ThreadPool* owner = nullptr;
+
+        // Owner-only "next task" slot; runs before the local queue.
+        std::function<void()> lifoSlot;
+        unsigned lifoRuns = 0;              // Consecutive slot runs
+        std::atomic<size_t> localPending = 0;
+
+        // Owner pushes/pops at the bottom, other workers steal the top
+        WorkStealingDeque<LocalTask> local;
+        // Tasks routed here by affinity key, from any thread
+        std::mutex inboxMutex;
+        std::deque<std::function<void()>> inbox;
+        std::atomic<size_t> inboxSize = 0;
+        std::atomic<bool> sleeping = false; // Idle in the eventcount
+        std::vector<std::function<void()>> batch; // Scratch for batched dequeue
+        unsigned tick = 0;
+
+        // Heartbeat: start of the running task (steady_clock ns, 0 when
+        // idle) and how many tasks this worker has started
+        std::atomic<int64_t> taskStart = 0;
+        std::atomic<uint64_t> tasksStarted = 0;
+
+        // Watchdog bookkeeping, touched only under watchdogMutex
+        uint64_t stalledTask = 0;           // tasksStarted value we flagged
+        bool stalled = false;
+        bool replaced = false;
+    };
+
+    // Consecutive slot runs before a worker must go back to the queues,
+    // so a self-feeding chain can't starve everyone else.
+    static constexpr unsigned kLifoBudget = 3;
+    // A worker with local work still checks the shared queue this often.
+    static constexpr unsigned kGlobalPollInterval = 61;
+
     void addThread();
-    void workerLoop(); // The main loop for each worker thread
+    void applySize();
+    bool borrowThread();
+    void returnThread();
+    void workerLoop(Worker& self); // The main loop for each worker thread
+    void park(Worker& self);
+    void wakeNextParked(size_t from);
+    std::function<void()> findTask(Worker& self);
+    bool tryPopShared(Worker& self, std::function<void()>& task);
+    bool tryPopGlobal(Worker& self, std::function<void()>& task);
+    bool tryPopTenant(std::function<void()>& task);
+    bool tryPopTagged(std::function<void()>& task);
+    void pushGlobal(std::function<void()> task);
+    void pushLocal(Worker& self, std::function<void()> task);
+    LocalTask* makeLocalTask(std::function<void()> task) const;
+    void flushLocal(Worker& self);
+    bool tryPopInbox(Worker& victim, std::function<void()>& task);
+    bool inboxStealable(const Worker& victim) const;
+    bool hasStealableWork() const;
+    bool hasWork(const Worker& self) const;
+    void runTask(Worker& self, std::function<void()>& task);
+    void prefetchNext(Worker& self);
+    void checkWatchdog();
+    void armWatchdog();
+
+    static thread_local Worker* currentWorker;
 
     size_t maxThreads;
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
+    ThreadOptions threadOptions;
+    WorkerHook onWorkerStart;
+    WorkerHook onWorkerStop;
+
+    // Sized to maxThreads up front so idle workers can scan their peers'
+    // queues without a lock; only the first workerCount entries are set.
+    // The worker set has its own lock so resizing never contends with the
+    // task path; workers only read their own atomic `retire` flag.
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> workerCount = 0;
+    mutable std::mutex workersMutex;
+    std::atomic<size_t> activeWorkers = 0;
+    // Active size is targetThreads (set by resize) plus the workers the
+    // watchdog borrowed, clamped to maxThreads. Guarded by workersMutex.
+    size_t targetThreads = 0;
+    size_t borrowedThreads = 0;
+    // Workers the running parallelRegion counts on; the active size never
+    // drops below this. Guarded by workersMutex.
+    size_t regionReserved = 0;
+    std::mutex regionMutex; // One parallelRegion at a time
+
+    // Shared queue for submissions from outside the pool
+    std::unique_ptr<TaskQueue> injection;
+    TenantScheduler tenants;
+    CostScheduler costs;
+    TimerQueue timers;
 
-    mutable std::mutex queueMutex;
-    std::condition_variable condition;
+    mutable std::mutex watchdogMutex;
+    WatchdogOptions watchdog;
+    bool watchdogEnabled = false;       // Guarded by watchdogMutex
+    uint64_t watchdogGeneration = 0;    // Invalidates timers of older enables
+    std::atomic<size_t> stalledWorkers = 0;
+    // Idle workers sleep here; notifying costs nothing while nobody sleeps
+    EventCount wakeup;
     std::atomic<bool> stop = false;
+    std::atomic<bool> shuttingDown = false;
+    std::atomic<bool> paused = false;
+    std::atomic<bool> lifoEnabled = false;
+    std::atomic<bool> localQueueEnabled = true;
+    std::atomic<size_t> maxDequeueBatch = 32;
+    std::atomic<size_t> affinityStealThreshold = 16;
+    std::atomic<bool> prefetchHints = false; // Set by the first hinted task
 };
 
-} // namespace MB
\ No newline at end of file
+} // namespace MB
@@ -0,0 +1,72 @@
+#include "TimerQueue.h"
+
+namespace MB {
+
+TimerQueue::~TimerQueue() {
+    shutdown();
+}
+
+void TimerQueue::schedule(Clock::time_point deadline, std::function<void()> callback) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!closed) {
+            if (!thread.joinable()) {
+                thread = std::thread([this] { run(); });
+            }
+            bool earliest = entries.empty() || deadline < entries.top().deadline;
+            entries.push(Entry{deadline, nextSequence++, std::move(callback)});
+            lock.unlock();
+            if (earliest) {
+                changed.notify_one();
+            }
+            return;
+        }
+    }
+    callback();
+}
+
+void TimerQueue::shutdown() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (closed) {
+            return;
+        }
+        closed = true;
+    }
+    changed.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+size_t TimerQueue::pendingCount() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+void TimerQueue::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        if (entries.empty()) {
+            if (closed) {
+                return;
+            }
+            changed.wait(lock);
+            continue;
+        }
+        // After shutdown everything is due
+        // A copy: schedule() may reallocate the heap while we wait
+        Clock::time_point deadline = entries.top().deadline;
+        if (!closed && Clock::now() < deadline) {
+            changed.wait_until(lock, deadline);
+            continue;
+        }
+        std::function<void()> callback = std::move(const_cast<Entry&>(entries.top()).callback);
+        entries.pop();
+        lock.unlock();
+        callback();
+        lock.lock();
+    }
+}
+
+} // namespace MB
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace MB {
+
+// Runs callbacks at a deadline on a single background thread, which is only
+// started by the first schedule() call. Callbacks should be short; the pool
+// uses them to hand tasks back to its queues.
+class TimerQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerQueue() = default;
+    ~TimerQueue();
+
+    TimerQueue(const TimerQueue&) = delete;
+    TimerQueue& operator=(const TimerQueue&) = delete;
+
+    void schedule(Clock::time_point deadline, std::function<void()> callback);
+
+    // Fire everything still pending right away and stop the thread. Later
+    // schedule() calls run their callback inline.
+    void shutdown();
+
+    size_t pendingCount() const;
+
+private:
+    struct Entry {
+        Clock::time_point deadline;
+        uint64_t sequence; // FIFO among equal deadlines
+        std::function<void()> callback;
+
+        bool operator>(const Entry& other) const {
+            return deadline != other.deadline ? deadline > other.deadline
+                                              : sequence > other.sequence;
+        }
+    };
+
+    void run();
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> entries;
+    uint64_t nextSequence = 0;
+    bool closed = false;
+    std::thread thread;
+};
+
+} // namespace MB
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ThreadPool.h"
+
+namespace MB {
+
+namespace detail {
+
+// One std::vector per argument: a plain Arg gets one column, a
+// std::tuple<A, B, ...> gets one column per element.
+template <typename Arg>
+struct TypedColumns {
+    using type = std::tuple<std::vector<Arg>>;
+    static constexpr size_t count = 1;
+    static constexpr bool split = false;
+};
+
+template <typename... Ts>
+struct TypedColumns<std::tuple<Ts...>> {
+    using type = std::tuple<std::vector<Ts>...>;
+    static constexpr size_t count = sizeof...(Ts);
+    static constexpr bool split = true;
+};
+
+// Fn::batchWidth if Fn declares a batched implementation, else 1
+template <typename Fn, typename = void>
+struct BatchWidth : std::integral_constant<size_t, 1> {};
+
+template <typename Fn>
+struct BatchWidth<Fn, std::void_t<decltype(Fn::batchWidth)>>
+    : std::integral_constant<size_t, Fn::batchWidth> {};
+
+} // namespace detail
+
+// Runs many calls of one function on a ThreadPool without a std::function or
+// heap node per call. Arguments are buffered in a struct-of-arrays layout
+// and handed to the pool in chunks; each chunk is one task that calls Fn in
+// a tight loop, which the compiler can inline and vectorize.
+//
+//     auto kernel = [](double x) { ... };
+//     auto typed = MB::makeTypedPool<double>(pool, kernel);
+//     for (double x : inputs) typed.submit(x);
+//     typed.wait();
+//
+// With Arg = std::tuple<A, B>, Fn is called as fn(a, b). A kernel that can
+// run several calls at once in SIMD lanes declares it:
+//
+//     static constexpr size_t batchWidth = 4;
+//     void batch(const A* a, const B* b) const; // a[0..3], b[0..3]
+//
+// and workers then call batch() on each group of batchWidth consecutive
+// calls in a chunk, and operator() only on the leftovers. Results go wherever
+// Fn writes them. Fn is shared by every worker, so its call operator must be
+// safe to run concurrently. submit() is not thread-safe; use one TypedPool
+// per submitting thread. Calling wait() from one of the pool's own tasks can
+// deadlock.
+template <typename Arg, typename Fn>
+class TypedPool {
+public:
+    explicit TypedPool(ThreadPool& pool, Fn fn = Fn{}, size_t chunkSize = 256)
+        : pool(pool), fn(std::move(fn)), chunkSize(std::max<size_t>(chunkSize, 1)) {}
+
+    ~TypedPool() { wait(); }
+
+    TypedPool(const TypedPool&) = delete;
+    TypedPool& operator=(const TypedPool&) = delete;
+
+    void submit(const Arg& arg) {
+        append(arg, std::make_index_sequence<detail::TypedColumns<Arg>::count>{});
+        if (++buffered >= chunkSize * 16) {
+            flush();
+        }
+    }
+
+    void submitBatch(const Arg* args, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            append(args[i], std::make_index_sequence<detail::TypedColumns<Arg>::count>{});
+        }
+        buffered += count;
+        flush();
+    }
+
+    // Hands everything buffered so far to the pool
+    void flush() {
+        if (buffered == 0) {
+            return;
+        }
+        auto batch = std::make_shared<const Columns>(std::move(columns));
+        columns = Columns{};
+        size_t total = buffered;
+        buffered = 0;
+
+        std::vector<std::function<void()>> chunks;
+        chunks.reserve((total + chunkSize - 1) / chunkSize);
+        for (size_t begin = 0; begin < total; begin += chunkSize) {
+            size_t end = std::min(total, begin + chunkSize);
+            chunks.push_back([this, batch, begin, end] { runChunk(*batch, begin, end); });
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            outstanding += chunks.size();
+        }
+        pool.enqueueBulk(std::move(chunks));
+    }
+
+    // Flushes, then blocks until every submitted call has run
+    void wait() {
+        flush();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return outstanding == 0; });
+    }
+
+private:
+    using Columns = typename detail::TypedColumns<Arg>::type;
+
+    template <size_t... I>
+    void append(const Arg& arg, std::index_sequence<I...>) {
+        if constexpr (detail::TypedColumns<Arg>::split) {
+            (std::get<I>(columns).push_back(std::get<I>(arg)), ...);
+        } else {
+            std::get<0>(columns).push_back(arg);
+        }
+    }
+
+    template <size_t... I>
+    void callRange(const Columns& batch, size_t begin, size_t end, std::index_sequence<I...>) {
+        size_t i = begin;
+        if constexpr (detail::BatchWidth<Fn>::value > 1) {
+            constexpr size_t width = detail::BatchWidth<Fn>::value;
+            for (; i + width <= end; i += width) {
+                fn.batch((std::get<I>(batch).data() + i)...);
+            }
+        }
+        for (; i < end; ++i) {
+            fn(std::get<I>(batch)[i]...);
+        }
+    }
+
+    void runChunk(const Columns& batch, size_t begin, size_t end) {
+        callRange(batch, begin, end, std::make_index_sequence<detail::TypedColumns<Arg>::count>{});
+        // Under the lock, so wait() can't return while we still touch *this
+        std::unique_lock<std::mutex> lock(mutex);
+        if (--outstanding == 0) {
+            done.notify_all();
+        }
+    }
+
+    ThreadPool& pool;
+    Fn fn;
+    const size_t chunkSize;
+
+    Columns columns; // Submitted since the last flush
+    size_t buffered = 0;
+
+    std::mutex mutex;
+    size_t outstanding = 0; // Chunks queued or running, guarded by mutex
+    std::condition_variable done;
+};
+
+template <typename Arg, typename Fn>
+TypedPool<Arg, Fn> makeTypedPool(ThreadPool& pool, Fn fn, size_t chunkSize = 256) {
+    return TypedPool<Arg, Fn>(pool, std::move(fn), chunkSize);
+}
+
+} // namespace MB
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "Epoch.h"
+
+namespace MB {
+
+// Chase-Lev work-stealing deque, following Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models". The owning thread pushes and pops
+// at the bottom without locks; any other thread may steal from the top.
+// Items are raw pointers and whoever pops or steals one owns it. Rings
+// outgrown by push() are reclaimed through MB::epoch.
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 256) {
+        size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+        ring.store(new Ring(rounded), std::memory_order_relaxed);
+    }
+
+    ~WorkStealingDeque() { delete ring.load(std::memory_order_relaxed); }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only.
+    void push(T* item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Ring* r = ring.load(std::memory_order_relaxed);
+        if (b - t > static_cast<int64_t>(r->capacity()) - 1) {
+            r = grow(r, t, b);
+        }
+        r->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only. Returns nullptr when empty.
+    T* pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Ring* r = ring.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        T* item = nullptr;
+        if (t <= b) {
+            item = r->get(b);
+            if (t == b) {
+                // Last item: race the thieves for it
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed)) {
+                    item = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Owner only. The item pop() would return next, left in place; nullptr
+    // when empty. A thief may take and free it meanwhile, so callers must
+    // have thieves reclaim items through MB::epoch before dereferencing.
+    T* peek() const {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        int64_t t = top.load(std::memory_order_acquire);
+        if (t > b) {
+            return nullptr;
+        }
+        return ring.load(std::memory_order_relaxed)->get(b);
+    }
+
+    // Any thread. Returns nullptr when empty or when another thread won.
+    T* steal() {
+        epoch::Guard guard; // Keeps a ring the owner outgrows alive
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Ring* r = ring.load(std::memory_order_acquire);
+        T* item = r->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Approximate when called concurrently with push/pop/steal.
+    size_t size() const {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    struct Ring {
+        explicit Ring(size_t capacity)
+            : mask(capacity - 1), slots(new std::atomic<T*>[capacity]) {}
+
+        size_t capacity() const { return mask + 1; }
+        T* get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T* item) { slots[i & mask].store(item, std::memory_order_relaxed); }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+    };
+
+    Ring* grow(Ring* old, int64_t t, int64_t b) {
+        Ring* bigger = new Ring(old->capacity() * 2);
+        for (int64_t i = t; i < b; ++i) {
+            bigger->put(i, old->get(i));
+        }
+        ring.store(bigger, std::memory_order_release);
+        // A thief may still be reading from the old ring
+        epoch::retire(old);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    alignas(64) std::atomic<Ring*> ring{nullptr};
+};
+
+} // namespace MB
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+
+namespace MB {
+
+// Per-worker state for a ThreadPool: one cache-line-aligned slot per worker
+// index, with no lazy-init guard on access. Warm the slots up from the
+// pool's onWorkerStart hook and reach them from tasks through local(pool),
+// or through operator[] when the index is already known.
+//
+//     MB::WorkerLocal<std::vector<char>> scratch(MAX_THREADS);
+//     MB::ThreadPool pool(4, MAX_THREADS,
+//                         [&](size_t i) { scratch[i].resize(1 << 20); });
+//     pool.enqueue([&] { auto& buf = scratch.local(pool); /* ... */ });
+//
+// local() costs one thread_local read to find the calling worker, plus a
+// check that it belongs to `pool`. A task that touches its slot in a hot
+// loop should take the index once from pool.workerIndex() and index
+// directly. A WorkerLocal serves one pool and must outlive it.
+template <typename T>
+class WorkerLocal {
+public:
+    explicit WorkerLocal(size_t maxThreads)
+        : slotCount(maxThreads), slots(new Slot[maxThreads]) {}
+
+    WorkerLocal(const WorkerLocal&) = delete;
+    WorkerLocal& operator=(const WorkerLocal&) = delete;
+
+    T& operator[](size_t workerIndex) { return slots[workerIndex].value; }
+    const T& operator[](size_t workerIndex) const { return slots[workerIndex].value; }
+
+    // Slot of the calling worker; throws when called off pool's workers,
+    // including from a worker of some other pool
+    T& local(const ThreadPool& pool) {
+        size_t index = pool.workerIndex();
+        if (index >= slotCount) {
+            throw std::out_of_range("WorkerLocal::local() called outside a worker of its pool");
+        }
+        return slots[index].value;
+    }
+
+    size_t size() const { return slotCount; }
+
+private:
+    // Keep neighbouring workers' state off each other's cache lines
+    struct alignas(64) Slot {
+        T value{};
+    };
+
+    size_t slotCount;
+    std::unique_ptr<Slot[]> slots;
+};
+
+} // namespace MB
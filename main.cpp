@@ -65,6 +65,7 @@ void printStats(MB::ThreadPool& pool, std::atomic<size_t>& tasksCompleted, std::
         // Lock once to print a clean, single line.
         std::lock_guard<std::mutex> lock(g_cout_mutex);
         std::cout << "[Stats] Active Threads: " << pool.getThreadCount()
+                  << " | Stalled: " << pool.getStalledWorkerCount()
                   << " | Pending Tasks: " << pool.getPendingTaskCount()
                   << " | Completed Tasks: " << tasksCompleted.load() << std::endl;
     }
@@ -73,6 +74,7 @@ void printStats(MB::ThreadPool& pool, std::atomic<size_t>& tasksCompleted, std::
 // 4. MAIN IS UPDATED to manage the new stats thread and print the final report.
 int main() {
     MB::ThreadPool pool(INITIAL_THREADS, MAX_THREADS);
+    pool.enableWatchdog(); // Report tasks that hang a worker for > 5s
 
     std::atomic<size_t> tasksCompleted = 0;
     std::atomic<bool> stopAll = false;
@@ -0,0 +1,1240 @@
+#include "ThreadPool.h"
+#include "RateLimiter.h"
+#include "FlatCombiningQueue.h"
+#include "PerCpuTaskQueue.h"
+#include "SegmentedTaskQueue.h"
+#include "Fiber.h"
+#include "SingleFlight.h"
+#include "TypedPool.h"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <memory>
+
+#if defined(__unix__)
+#include <sys/resource.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Micro-benchmarks for MB::ThreadPool.
+// Run `main_bench <scenario>`; without an argument every scenario is listed.
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void waitFor(const std::atomic<size_t>& counter, size_t target) {
+    while (counter.load() < target) {
+        std::this_thread::yield();
+    }
+}
+
+// --- ping-pong chain ---
+// Each hop touches the chain's buffer and enqueues exactly one follow-up,
+// the actor-mailbox pattern the worker LIFO slot is meant for.
+struct Chain {
+    MB::ThreadPool* pool;
+    std::vector<int> data;
+    size_t remaining;
+    std::atomic<size_t>* done;
+
+    void hop() {
+        for (int& x : data) {
+            ++x;
+        }
+        if (--remaining == 0) {
+            ++*done;
+            return;
+        }
+        pool->enqueue([this] { hop(); });
+    }
+};
+
+static double runPingPong(bool lifo, size_t threads, size_t chains, size_t hops) {
+    MB::ThreadPool pool(threads, threads);
+    pool.setLifoSlotEnabled(lifo);
+
+    std::atomic<size_t> done = 0;
+    std::vector<Chain> all(chains);
+    for (Chain& c : all) {
+        c = Chain{&pool, std::vector<int>(4096), hops, &done};
+    }
+
+    auto start = Clock::now();
+    for (Chain& c : all) {
+        pool.enqueue([&c] { c.hop(); });
+    }
+    waitFor(done, chains);
+    return elapsedMs(start);
+}
+
+static void benchPingPong() {
+    const size_t threads = 4, chains = 4, hops = 20'000;
+    double fifo = runPingPong(false, threads, chains, hops);
+    double lifo = runPingPong(true, threads, chains, hops);
+    std::cout << "ping-pong " << chains << " chains x " << hops << " hops on "
+              << threads << " threads\n"
+              << "  global FIFO: " << fifo << " ms\n"
+              << "  LIFO slot:   " << lifo << " ms (" << fifo / lifo << "x)" << std::endl;
+}
+
+// --- recursive spawn ---
+// A binary tree of tasks where every inner node enqueues its two children
+// from inside the pool, so nearly every submission comes from a worker.
+static void spawnTree(MB::ThreadPool& pool, unsigned depth, std::atomic<size_t>& leaves) {
+    if (depth == 0) {
+        ++leaves;
+        return;
+    }
+    for (int child = 0; child < 2; ++child) {
+        pool.enqueue([&pool, depth, &leaves] { spawnTree(pool, depth - 1, leaves); });
+    }
+}
+
+static double runSpawn(bool localQueues, bool lifoSlot, size_t threads, unsigned depth) {
+    MB::ThreadPool pool(threads, threads);
+    pool.setLocalQueueEnabled(localQueues);
+    pool.setLifoSlotEnabled(lifoSlot);
+
+    std::atomic<size_t> leaves = 0;
+    auto start = Clock::now();
+    pool.enqueue([&pool, depth, &leaves] { spawnTree(pool, depth, leaves); });
+    waitFor(leaves, size_t(1) << depth);
+    return elapsedMs(start);
+}
+
+static void benchSpawn() {
+    const size_t threads = 4;
+    const unsigned depth = 18;
+    double shared = runSpawn(false, false, threads, depth);
+    double local = runSpawn(true, false, threads, depth);
+    double slot = runSpawn(true, true, threads, depth);
+    std::cout << "recursive spawn, " << ((size_t(2) << depth) - 1) << " tasks on "
+              << threads << " threads\n"
+              << "  shared queue:             " << shared << " ms\n"
+              << "  local queues:             " << local << " ms (" << shared / local << "x)\n"
+              << "  local queues + LIFO slot: " << slot << " ms (" << shared / slot << "x)"
+              << std::endl;
+}
+
+// --- wakeups ---
+// Bursty external producer: workers keep going idle between bursts, so the
+// interesting number is how often an enqueue has to enter the kernel.
+static long voluntaryContextSwitches() {
+#if defined(__unix__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw;
+#else
+    return 0;
+#endif
+}
+
+static void benchWakeups() {
+    using namespace std::chrono_literals;
+    const size_t threads = 4, bursts = 2'000, burstSize = 100;
+    const size_t total = bursts * burstSize;
+
+    MB::ThreadPool pool(threads, threads);
+    std::atomic<size_t> done = 0;
+    long switchesBefore = voluntaryContextSwitches();
+    auto start = Clock::now();
+    for (size_t b = 0; b < bursts; ++b) {
+        for (size_t i = 0; i < burstSize; ++i) {
+            pool.enqueue([&done] { ++done; });
+        }
+        std::this_thread::sleep_for(50us);
+    }
+    waitFor(done, total);
+    double ms = elapsedMs(start);
+    long switches = voluntaryContextSwitches() - switchesBefore;
+
+    std::cout << "bursty enqueue, " << total << " tasks on " << threads << " threads in "
+              << ms << " ms\n"
+              << "  kernel wakeups per task:    " << double(pool.getWakeupCount()) / total << "\n"
+              << "  voluntary ctx sw per task:  " << double(switches) / total << std::endl;
+}
+
+// --- mass wakeup ---
+// Hundreds of idle workers: one bulk enqueue, then pool destruction. Both
+// used to wake every worker at once to fight over the queue lock.
+static void benchMassWakeup() {
+    using namespace std::chrono_literals;
+    const size_t threads = 256, total = 100'000;
+
+    auto pool = std::make_unique<MB::ThreadPool>(threads, threads);
+    std::this_thread::sleep_for(100ms); // Let every worker go idle
+
+    std::atomic<size_t> done = 0;
+    std::vector<std::function<void()>> batch;
+    batch.reserve(total);
+    for (size_t i = 0; i < total; ++i) {
+        batch.push_back([&done] { ++done; });
+    }
+    auto start = Clock::now();
+    pool->enqueueBulk(std::move(batch));
+    waitFor(done, total);
+    double drainMs = elapsedMs(start);
+    uint64_t wakeups = pool->getWakeupCount();
+
+    std::this_thread::sleep_for(100ms);
+    start = Clock::now();
+    pool.reset();
+    double shutdownMs = elapsedMs(start);
+
+    std::cout << "mass wakeup with " << threads << " idle workers\n"
+              << "  bulk enqueue of " << total << " tasks: " << drainMs << " ms, "
+              << wakeups << " kernel wakeups\n"
+              << "  shutdown: " << shutdownMs << " ms" << std::endl;
+}
+
+// --- shrink then enqueue ---
+// Idle workers retired while asleep on the eventcount: the wakeup for the
+// next task may reach one of them, which must pass it on to the worker that
+// stays active instead of parking with it. Worker 0, the one that stays, is
+// made the last to fall asleep, so the kernel wakes a retired one first.
+static void benchShrinkWakeup() {
+    using namespace std::chrono_literals;
+    const size_t threads = 4, rounds = 50;
+    size_t stranded = 0;
+    double worstMs = 0;
+    for (size_t r = 0; r < rounds; ++r) {
+        MB::ThreadPool pool(threads, threads);
+        std::this_thread::sleep_for(5ms); // Let every worker go idle
+        // Affinity keys until one lands on worker 0
+        std::atomic<size_t> ranOn = MB::ThreadPool::npos;
+        for (uint64_t key = 0; ranOn.load() != 0; ++key) {
+            ranOn = threads;
+            pool.enqueue([&ranOn] { ranOn = MB::ThreadPool::currentWorkerIndex(); }, key);
+            while (ranOn.load() == threads) {
+                std::this_thread::yield();
+            }
+        }
+        std::this_thread::sleep_for(5ms);
+        pool.resize(1);
+
+        std::atomic<size_t> done = 0;
+        auto start = Clock::now();
+        pool.enqueue([&done] { ++done; });
+        while (done.load() == 0 && Clock::now() - start < 1s) {
+            std::this_thread::yield();
+        }
+        if (done.load() == 0) {
+            ++stranded;
+            pool.resize(threads); // Unpark everyone so the task still runs
+            waitFor(done, 1);
+        }
+        worstMs = std::max(worstMs, elapsedMs(start));
+    }
+    std::cout << "resize(" << threads << " -> 1) on an idle pool, then one enqueue, "
+              << rounds << " rounds\n"
+              << "  tasks stranded for > 1 s: " << stranded << "\n"
+              << "  worst latency: " << worstMs << " ms" << std::endl;
+}
+
+// --- tenants ---
+// One tenant floods the pool; a second, light tenant submits a few tasks
+// afterwards. With a single FIFO the light tenant waits behind the whole
+// flood; with tenant queues it gets every other turn.
+static void spin(std::chrono::microseconds duration) {
+    auto end = Clock::now() + duration;
+    while (Clock::now() < end) {
+    }
+}
+
+static double runTenants(bool tagged, size_t threads, size_t flood, size_t light) {
+    using namespace std::chrono_literals;
+    MB::ThreadPool pool(threads, threads);
+    std::atomic<size_t> floodDone = 0, lightDone = 0;
+
+    auto submit = [&](MB::TenantId tenant, std::function<void()> task) {
+        if (tagged) {
+            pool.enqueue(tenant, std::move(task));
+        } else {
+            pool.enqueue(std::move(task));
+        }
+    };
+    for (size_t i = 0; i < flood; ++i) {
+        submit(1, [&floodDone] { spin(50us); ++floodDone; });
+    }
+    auto start = Clock::now();
+    for (size_t i = 0; i < light; ++i) {
+        submit(2, [&lightDone] { spin(50us); ++lightDone; });
+    }
+    waitFor(lightDone, light);
+    double ms = elapsedMs(start);
+    waitFor(floodDone, flood);
+    return ms;
+}
+
+static void benchTenants() {
+    const size_t threads = 4, flood = 10'000, light = 50;
+    double fifo = runTenants(false, threads, flood, light);
+    double drr = runTenants(true, threads, flood, light);
+    std::cout << "light tenant (" << light << " tasks) behind a flood of " << flood
+              << " tasks on " << threads << " threads\n"
+              << "  shared FIFO:        " << fifo << " ms\n"
+              << "  tenant round robin: " << drr << " ms" << std::endl;
+}
+
+// --- rate limiting ---
+// A burst of submissions against a 2000 tasks/s class, raised to 10000/s
+// halfway. Over-budget tasks wait on the pool's timer, not on a thread.
+// Then a limiter with work deferred at 0.1/s is raised and unlimited.
+static void benchRateLimit() {
+    const size_t threads = 4, total = 4'000;
+    MB::ThreadPool pool(threads, threads);
+    MB::RateLimiter limiter(pool, 2'000.0, 10.0);
+
+    std::atomic<size_t> done = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < total / 2; ++i) {
+        limiter.enqueue([&done] { ++done; });
+    }
+    waitFor(done, total / 2);
+    double slowMs = elapsedMs(start);
+
+    limiter.setRate(10'000.0, 10.0);
+    start = Clock::now();
+    for (size_t i = 0; i < total / 2; ++i) {
+        limiter.enqueue([&done] { ++done; });
+    }
+    waitFor(done, total);
+    double fastMs = elapsedMs(start);
+
+    std::cout << "rate-limited class, " << total / 2 << " tasks per phase\n"
+              << "  at  2000/s: " << slowMs << " ms (" << (total / 2) / (slowMs / 1000) << " tasks/s)\n"
+              << "  at 10000/s: " << fastMs << " ms (" << (total / 2) / (fastMs / 1000) << " tasks/s)"
+              << std::endl;
+
+    // Work stuck behind a 0.1/s limit must follow a rate change right away,
+    // both to a faster rate and to no limit at all
+    auto stuckThenChanged = [&](double rate, double burst) {
+        MB::RateLimiter slow(pool, 0.1, 1.0);
+        std::atomic<size_t> ran = 0;
+        for (int i = 0; i < 5; ++i) {
+            slow.enqueue([&ran] { ++ran; });
+        }
+        auto changed = Clock::now();
+        slow.setRate(rate, burst);
+        waitFor(ran, 5);
+        return elapsedMs(changed);
+    };
+    std::cout << "  5 tasks deferred at 0.1/s, then raised to 1000/s: released in "
+              << stuckThenChanged(1'000.0, 10.0) << " ms\n"
+              << "  5 tasks deferred at 0.1/s, then limit removed:    released in "
+              << stuckThenChanged(0.0, 1.0) << " ms" << std::endl;
+}
+
+// --- batched dequeue ---
+// ~1 us tasks from an external producer: lock handoff on the shared queue
+// dominates unless workers take several tasks per acquisition.
+static double runBatched(size_t threads, size_t maxBatch, size_t total) {
+    using namespace std::chrono_literals;
+    MB::ThreadPool pool(threads, threads);
+    pool.setMaxDequeueBatch(maxBatch);
+
+    std::atomic<size_t> done = 0;
+    auto start = Clock::now();
+    const size_t chunk = 1'000;
+    for (size_t i = 0; i < total; i += chunk) {
+        std::vector<std::function<void()>> batch;
+        batch.reserve(chunk);
+        for (size_t j = 0; j < chunk; ++j) {
+            batch.push_back([&done] { spin(1us); ++done; });
+        }
+        pool.enqueueBulk(std::move(batch));
+    }
+    waitFor(done, total);
+    return total / (elapsedMs(start) / 1000.0);
+}
+
+static void benchBatch() {
+    const size_t total = 200'000;
+    std::cout << "1 us tasks, " << total << " per run (tasks/s)\n";
+    for (size_t threads : {8, 16, 32, 64}) {
+        double single = runBatched(threads, 1, total);
+        double batched = runBatched(threads, 32, total);
+        std::cout << "  " << threads << " threads: one per lock " << single
+                  << ", batched " << batched << " (" << batched / single << "x)" << std::endl;
+    }
+}
+
+// --- flat combining ---
+// Many producers hammering the shared queue at once, as with a dozen
+// produceTasks loops feeding one pool. Compares the queue backends on their
+// own and inside the pool, with a bounded lock-free ring for reference.
+
+// Vyukov's bounded MPMC ring: one CAS per operation, no lock at all.
+class BoundedRing {
+public:
+    explicit BoundedRing(size_t capacity) : mask(capacity - 1), cells(capacity) {
+        for (size_t i = 0; i < capacity; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool tryPush(std::function<void()>& task) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.task = std::move(task);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos) {
+                return false; // Full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(std::function<void()>& task) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos + 1) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    task = std::move(cell.task);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos + 1) {
+                return false; // Empty
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> sequence;
+        std::function<void()> task;
+    };
+
+    size_t mask;
+    std::vector<Cell> cells;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+// Runs `producers` threads pushing perProducer tasks each and `consumers`
+// threads popping and running them; returns tasks/s.
+template <typename Push, typename Pop>
+static double runQueue(size_t producers, size_t consumers, size_t perProducer,
+                       Push push, Pop pop) {
+    const size_t total = producers * perProducer;
+    std::atomic<size_t> done = 0;
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&] {
+            for (size_t i = 0; i < perProducer; ++i) {
+                push([&done] { ++done; });
+            }
+        });
+    }
+    for (size_t c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            std::vector<std::function<void()>> out;
+            while (done.load(std::memory_order_relaxed) < total) {
+                if (!pop(out)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (auto& task : out) {
+                    task();
+                }
+                out.clear();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    return total / (elapsedMs(start) / 1000.0);
+}
+
+static double runQueue(MB::TaskQueue& queue, size_t producers, size_t consumers,
+                       size_t perProducer) {
+    return runQueue(producers, consumers, perProducer,
+                    [&](std::function<void()> task) { queue.push(std::move(task)); },
+                    [&](std::vector<std::function<void()>>& out) {
+                        return queue.popBatch(out, 1) > 0;
+                    });
+}
+
+static double runRing(size_t producers, size_t consumers, size_t perProducer) {
+    BoundedRing ring(1 << 16);
+    return runQueue(producers, consumers, perProducer,
+                    [&](std::function<void()> task) {
+                        while (!ring.tryPush(task)) {
+                            std::this_thread::yield();
+                        }
+                    },
+                    [&](std::vector<std::function<void()>>& out) {
+                        std::function<void()> task;
+                        if (!ring.tryPop(task)) {
+                            return false;
+                        }
+                        out.push_back(std::move(task));
+                        return true;
+                    });
+}
+
+static double runPoolProducers(MB::QueueBackend backend, size_t producers, size_t threads,
+                               size_t perProducer) {
+    MB::ThreadPool pool(threads, threads, backend);
+    std::atomic<size_t> done = 0;
+    std::vector<std::thread> feeders;
+    auto start = Clock::now();
+    for (size_t p = 0; p < producers; ++p) {
+        feeders.emplace_back([&] {
+            for (size_t i = 0; i < perProducer; ++i) {
+                pool.enqueue([&done] { ++done; });
+            }
+        });
+    }
+    for (auto& t : feeders) {
+        t.join();
+    }
+    waitFor(done, producers * perProducer);
+    return producers * perProducer / (elapsedMs(start) / 1000.0);
+}
+
+static void benchCombining() {
+    const size_t consumers = 4, perProducer = 20'000;
+    std::cout << "shared queue under contention, " << perProducer
+              << " tasks per producer (tasks/s)\n";
+    for (size_t producers : {16, 32}) {
+        MB::MutexTaskQueue mutexQueue;
+        MB::FlatCombiningQueue combiningQueue;
+        double locked = runQueue(mutexQueue, producers, consumers, perProducer);
+        double combined = runQueue(combiningQueue, producers, consumers, perProducer);
+        double ring = runRing(producers, consumers, perProducer);
+        std::cout << "  " << producers << " producers, " << consumers << " consumers: mutex "
+                  << locked << ", flat combining " << combined << " (" << combined / locked
+                  << "x), lock-free ring " << ring << std::endl;
+    }
+    for (size_t producers : {16, 32}) {
+        double locked = runPoolProducers(MB::QueueBackend::Mutex, producers, 4, perProducer);
+        double combined =
+            runPoolProducers(MB::QueueBackend::FlatCombining, producers, 4, perProducer);
+        std::cout << "  pool, " << producers << " producers on 4 workers: mutex " << locked
+                  << ", flat combining " << combined << " (" << combined / locked << "x)"
+                  << std::endl;
+    }
+}
+
+// --- per-CPU queues ---
+// More producer threads than cores. Per-CPU queues keep each push and pop
+// on the current CPU's queue; with rseq that takes no atomic RMW at all.
+static void benchPerCpu() {
+    const size_t consumers = 4, perProducer = 20'000;
+    MB::PerCpuTaskQueue probe;
+    std::cout << "per-CPU queues (" << (probe.usesRseq() ? "rseq" : "segmented fallback")
+              << "), " << perProducer << " tasks per producer (tasks/s)\n";
+    for (size_t producers : {16, 32}) {
+        MB::MutexTaskQueue mutexQueue;
+        MB::PerCpuTaskQueue perCpuQueue;
+        double locked = runQueue(mutexQueue, producers, consumers, perProducer);
+        double perCpu = runQueue(perCpuQueue, producers, consumers, perProducer);
+        double pool = runPoolProducers(MB::QueueBackend::PerCpu, producers, 4, perProducer);
+        std::cout << "  " << producers << " producers, " << consumers << " consumers: mutex "
+                  << locked << ", per-CPU " << perCpu << " (" << perCpu / locked
+                  << "x), pool on per-CPU queues " << pool << std::endl;
+    }
+}
+
+// --- segmented queue ---
+// Unbounded lock-free list of arrays against std::queue + mutex, with
+// bursts far larger than any bounded ring would hold.
+static void benchSegmented() {
+    const size_t consumers = 4, perProducer = 50'000;
+    std::cout << "segmented lock-free queue vs std::queue + mutex, " << perProducer
+              << " tasks per producer (tasks/s)\n";
+    for (size_t producers : {1, 4, 16}) {
+        MB::MutexTaskQueue mutexQueue;
+        MB::SegmentedTaskQueue segmentedQueue;
+        double locked = runQueue(mutexQueue, producers, consumers, perProducer);
+        double segmented = runQueue(segmentedQueue, producers, consumers, perProducer);
+        std::cout << "  " << producers << " producers, " << consumers << " consumers: mutex "
+                  << locked << ", segmented " << segmented << " (" << segmented / locked << "x)"
+                  << std::endl;
+    }
+    for (size_t producers : {4, 16}) {
+        double locked = runPoolProducers(MB::QueueBackend::Mutex, producers, 4, perProducer);
+        double segmented =
+            runPoolProducers(MB::QueueBackend::Segmented, producers, 4, perProducer);
+        std::cout << "  pool, " << producers << " producers on 4 workers: mutex " << locked
+                  << ", segmented " << segmented << " (" << segmented / locked << "x)"
+                  << std::endl;
+    }
+}
+
+// --- typed pool ---
+// Many calls of the same small harmonic-sum kernel, as with makeHeavyTask
+// but far lighter: one std::function and heap node per call against
+// TypedPool's contiguous argument columns and one task per chunk.
+struct HarmonicTerm {
+    double* out;
+    void operator()(size_t i, double scale) const {
+        double sum = 0.0;
+        for (size_t j = 0; j < 64; ++j) {
+            sum += scale / double(i + j + 1);
+        }
+        out[i] = sum;
+    }
+};
+
+static void benchTyped() {
+    const size_t threads = 4, total = 500'000;
+    MB::ThreadPool pool(threads, threads);
+    std::vector<double> out(total);
+    HarmonicTerm kernel{out.data()};
+
+    std::atomic<size_t> done = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < total; ++i) {
+        pool.enqueue([&kernel, &done, i] { kernel(i, 3.14159); ++done; });
+    }
+    waitFor(done, total);
+    double erased = elapsedMs(start);
+
+    start = Clock::now();
+    {
+        MB::TypedPool<std::tuple<size_t, double>, HarmonicTerm> typed(pool, kernel);
+        for (size_t i = 0; i < total; ++i) {
+            typed.submit({i, 3.14159});
+        }
+        typed.wait();
+    }
+    double typedMs = elapsedMs(start);
+
+    std::cout << total << " harmonic-sum calls on " << threads << " threads\n"
+              << "  std::function per call: " << erased << " ms\n"
+              << "  TypedPool:              " << typedMs << " ms (" << erased / typedMs << "x)"
+              << std::endl;
+}
+
+// --- batched kernels ---
+// The makeHeavyTask workload (harmonic sums) with a different length per
+// task. A single sum is one long chain of dependent divisions; running four
+// sums side by side fills the SIMD lanes instead.
+struct HarmonicSum {
+    static constexpr size_t batchWidth = 4;
+    double* out;
+
+    void operator()(size_t task, size_t terms) const {
+        double sum = 0.0;
+        for (size_t j = 0; j < terms; ++j) {
+            sum += 3.14159 / double(j + 1);
+        }
+        out[task] = sum;
+    }
+
+    void batch(const size_t* task, const size_t* terms) const {
+        size_t common = std::min(std::min(terms[0], terms[1]), std::min(terms[2], terms[3]));
+        double sum[batchWidth] = {};
+        for (size_t j = 0; j < common; ++j) {
+            for (size_t lane = 0; lane < batchWidth; ++lane) {
+                sum[lane] += 3.14159 / double(j + 1);
+            }
+        }
+        for (size_t lane = 0; lane < batchWidth; ++lane) {
+            for (size_t j = common; j < terms[lane]; ++j) {
+                sum[lane] += 3.14159 / double(j + 1);
+            }
+            out[task[lane]] = sum[lane];
+        }
+    }
+};
+
+// Same kernel without the batched form
+struct ScalarHarmonicSum {
+    HarmonicSum inner;
+    void operator()(size_t task, size_t terms) const { inner(task, terms); }
+};
+
+static void benchVector() {
+    const size_t threads = 4, total = 2'000;
+    MB::ThreadPool pool(threads, threads);
+    std::vector<double> out(total);
+    std::vector<size_t> terms(total);
+    for (size_t i = 0; i < total; ++i) {
+        terms[i] = 20'000 + (i * 7919) % 40'000;
+    }
+    HarmonicSum kernel{out.data()};
+
+    std::atomic<size_t> done = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < total; ++i) {
+        pool.enqueue([&kernel, &done, &terms, i] { kernel(i, terms[i]); ++done; });
+    }
+    waitFor(done, total);
+    double perTask = elapsedMs(start);
+
+    auto runTyped = [&](auto fn) {
+        auto begin = Clock::now();
+        auto typed = MB::makeTypedPool<std::tuple<size_t, size_t>>(pool, fn, 16);
+        for (size_t i = 0; i < total; ++i) {
+            typed.submit({i, terms[i]});
+        }
+        typed.wait();
+        return elapsedMs(begin);
+    };
+    double scalar = runTyped(ScalarHarmonicSum{kernel});
+    double batched = runTyped(kernel);
+
+    std::cout << total << " harmonic sums of 20k-60k terms on " << threads << " threads\n"
+              << "  one task each:      " << perTask << " ms\n"
+              << "  TypedPool, scalar:  " << scalar << " ms\n"
+              << "  TypedPool, batched: " << batched << " ms (" << scalar / batched << "x)"
+              << std::endl;
+}
+
+// --- shortest expected job first ---
+// A burst mixing 20 us and 1 ms jobs. In submission order every short job
+// queues behind the long ones ahead of it; with the cost model the short
+// ones go first and the starvation limit bounds how long the long ones wait.
+struct LatencySummary {
+    double meanMs;
+    double p99Ms;
+};
+
+static LatencySummary summarize(std::vector<double> ms) {
+    std::sort(ms.begin(), ms.end());
+    double mean = std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size();
+    return {mean, ms[std::min(ms.size() - 1, ms.size() * 99 / 100)]};
+}
+
+static void runCostMix(bool shortestFirst, size_t threads) {
+    using namespace std::chrono_literals;
+    const size_t total = 2'100;
+    const MB::TaskTag shortTag = 1, longTag = 2;
+    MB::ThreadPool pool(threads, threads);
+    pool.setShortestJobFirst(shortestFirst, 100ms);
+
+    // Give the cost model some history first
+    std::atomic<size_t> done = 0;
+    for (int i = 0; i < 5; ++i) {
+        pool.enqueueTagged(shortTag, [&done] { spin(20us); ++done; });
+        pool.enqueueTagged(longTag, [&done] { spin(1ms); ++done; });
+    }
+    waitFor(done, 10);
+
+    done = 0;
+    std::vector<double> latency(total);
+    std::vector<bool> isLong(total);
+    for (size_t i = 0; i < total; ++i) {
+        isLong[i] = i % 21 == 0;
+        auto submitted = Clock::now();
+        auto work = isLong[i] ? std::chrono::microseconds(1ms) : 20us;
+        pool.enqueueTagged(isLong[i] ? longTag : shortTag, [&, i, submitted, work] {
+            spin(work);
+            latency[i] = elapsedMs(submitted);
+            ++done;
+        });
+    }
+    waitFor(done, total);
+
+    std::vector<double> shortMs, longMs;
+    for (size_t i = 0; i < total; ++i) {
+        (isLong[i] ? longMs : shortMs).push_back(latency[i]);
+    }
+    LatencySummary all = summarize(latency), shorts = summarize(shortMs), longs = summarize(longMs);
+    std::cout << "  " << (shortestFirst ? "shortest first: " : "submission order: ")
+              << "mean " << all.meanMs << " ms, p99 " << all.p99Ms << " ms"
+              << " | short mean " << shorts.meanMs << " ms, long mean " << longs.meanMs
+              << " ms, long max " << *std::max_element(longMs.begin(), longMs.end()) << " ms"
+              << std::endl;
+}
+
+static void benchCostModel() {
+    // No more workers than cores: a preempted 20 us job would be timed as
+    // a long one and skew the model
+    const size_t threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 4);
+    std::cout << "burst of 2000 x 20 us and 100 x 1 ms tagged jobs on " << threads
+              << " threads, latency from submission\n";
+    runCostMix(false, threads);
+    runCostMix(true, threads);
+}
+
+// --- singleflight ---
+// Eight request threads ask for the same 16 expensive results over and
+// over, the way concurrent requests hit a cold cache. Plain enqueue computes
+// every request; enqueueOnce attaches duplicates to the run in flight.
+static double harmonic(size_t terms) {
+    double sum = 0.0;
+    for (size_t j = 0; j < terms; ++j) {
+        sum += 3.14159 / double(j + 1);
+    }
+    return sum;
+}
+
+static void benchSingleFlight() {
+    const size_t threads = 4, requesters = 8, rounds = 50, keys = 16, terms = 200'000;
+    std::atomic<size_t> computed = 0;
+
+    auto run = [&](bool coalesce) {
+        MB::ThreadPool pool(threads, threads);
+        MB::SingleFlight<size_t, double> flights(pool);
+        computed = 0;
+        auto start = Clock::now();
+        std::vector<std::thread> clients;
+        for (size_t c = 0; c < requesters; ++c) {
+            clients.emplace_back([&] {
+                for (size_t r = 0; r < rounds; ++r) {
+                    std::vector<std::shared_future<double>> results;
+                    for (size_t k = 0; k < keys; ++k) {
+                        auto compute = [&computed, k, terms] {
+                            ++computed;
+                            return harmonic(terms + k);
+                        };
+                        if (coalesce) {
+                            results.push_back(flights.enqueueOnce(k, compute));
+                        } else {
+                            auto promise = std::make_shared<std::promise<double>>();
+                            results.push_back(promise->get_future().share());
+                            pool.enqueue([promise, compute] { promise->set_value(compute()); });
+                        }
+                    }
+                    for (auto& result : results) {
+                        result.wait();
+                    }
+                }
+            });
+        }
+        for (auto& t : clients) {
+            t.join();
+        }
+        return elapsedMs(start);
+    };
+
+    double plainMs = run(false);
+    size_t plainRuns = computed;
+    double onceMs = run(true);
+    size_t onceRuns = computed;
+    std::cout << requesters << " clients x " << rounds << " rounds x " << keys
+              << " keys of the same heavy computation\n"
+              << "  enqueue:     " << plainMs << " ms, " << plainRuns << " computations\n"
+              << "  enqueueOnce: " << onceMs << " ms, " << onceRuns << " computations ("
+              << plainMs / onceMs << "x)" << std::endl;
+
+    // Move-only tasks, e.g. ones owning a buffer, go through as well
+    MB::ThreadPool pool(threads, threads);
+    MB::SingleFlight<size_t, size_t> flights(pool);
+    auto buffer = std::make_unique<std::vector<double>>(terms, 1.0);
+    size_t length = flights.enqueueOnce(0, [buffer = std::move(buffer)] {
+        return buffer->size();
+    }).get();
+    std::cout << "  move-only task: " << (length == terms ? "ok" : "wrong result") << std::endl;
+}
+
+// --- affinity ---
+// Updates to 64 shards of 32 KB each, keyed by shard. Scattered over the
+// shared queue, consecutive updates to a shard land on different workers
+// and pull its lines across caches; keyed, each shard stays on one worker.
+
+// Cache misses of this process and the threads it starts afterwards, via
+// perf_event_open. Reads -1 where hardware counters are unavailable.
+class CacheMissCounter {
+public:
+    CacheMissCounter() {
+#if defined(__linux__)
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.inherit = 1; // Count the pool's threads too
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~CacheMissCounter() {
+#if defined(__linux__)
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    // Inherited counts only include threads that have exited, so read
+    // after the pool is gone
+    long long read() const {
+#if defined(__linux__)
+        long long value = 0;
+        if (fd >= 0 && ::read(fd, &value, sizeof(value)) == sizeof(value)) {
+            return value;
+        }
+#endif
+        return -1;
+    }
+
+private:
+    int fd = -1;
+};
+
+static void runShardUpdates(bool keyed, size_t threads, double& ms, long long& misses,
+                            size_t& migrations) {
+    const size_t shards = 64, shardBytes = 32 * 1024, updates = 100'000;
+    std::vector<std::vector<uint64_t>> data(shards, std::vector<uint64_t>(shardBytes / 8));
+    std::vector<std::atomic<size_t>> lastWorker(shards);
+    std::atomic<size_t> moved = 0;
+
+    CacheMissCounter counter;
+    {
+        MB::ThreadPool pool(threads, threads);
+        std::atomic<size_t> done = 0;
+        auto start = Clock::now();
+        for (size_t i = 0; i < updates; ++i) {
+            size_t shard = (i * 2654435761u) % shards;
+            auto update = [&, shard] {
+                size_t self = MB::ThreadPool::currentWorkerIndex();
+                if (lastWorker[shard].exchange(self) != self) {
+                    ++moved;
+                }
+                for (uint64_t& x : data[shard]) {
+                    x += shard;
+                }
+                ++done;
+            };
+            if (keyed) {
+                pool.enqueue(update, shard);
+            } else {
+                pool.enqueue(update);
+            }
+        }
+        waitFor(done, updates);
+        ms = elapsedMs(start);
+    }
+    misses = counter.read();
+    migrations = moved;
+}
+
+static void benchAffinity() {
+    const size_t threads = 4;
+    std::cout << "100000 updates over 64 x 32 KB shards on " << threads << " threads\n";
+    for (bool keyed : {false, true}) {
+        double ms = 0;
+        long long misses = 0;
+        size_t migrations = 0;
+        runShardUpdates(keyed, threads, ms, misses, migrations);
+        std::cout << "  " << (keyed ? "affinity key:  " : "shared queue:  ") << ms << " ms, "
+                  << migrations << " shard moves between workers, cache misses "
+                  << (misses < 0 ? std::string("n/a (no perf counters)") : std::to_string(misses))
+                  << std::endl;
+    }
+}
+
+// --- prefetch hints ---
+// Tasks over random 16 KB blocks of a 256 MB array, alternating a pointer
+// chase through the block and a plain sum, so each one starts on cold data
+static double runPrefetchMix(bool hinted, size_t threads, size_t tasks) {
+    const size_t blockWords = 2048, blocks = (256u << 20) / (blockWords * 8);
+    std::vector<uint64_t> data(blocks * blockWords);
+    for (size_t i = 0; i < data.size(); ++i) {
+        // Full-period LCG inside the block, so the chase visits every word
+        data[i] = (5 * (i % blockWords) + 1) % blockWords;
+    }
+    std::atomic<uint64_t> sink = 0;
+    std::atomic<size_t> done = 0;
+
+    MB::ThreadPool pool(threads, threads);
+    // Queue everything first, so workers dequeue in batches and always
+    // have a next task to look at
+    pool.pause();
+    uint64_t seed = 88172645463325252ull;
+    for (size_t i = 0; i < tasks; ++i) {
+        seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+        const uint64_t* block = data.data() + (seed % blocks) * blockWords;
+        std::function<void()> task;
+        if (i % 2 == 0) {
+            task = [&, block] {
+                uint64_t at = 0;
+                for (size_t hop = 0; hop < blockWords; ++hop) {
+                    at = block[at];
+                }
+                sink += at;
+                ++done;
+            };
+        } else {
+            task = [&, block] {
+                sink += std::accumulate(block, block + blockWords, uint64_t(0));
+                ++done;
+            };
+        }
+        if (hinted) {
+            pool.enqueue(std::move(task), MB::PrefetchHint{block, blockWords * 8});
+        } else {
+            pool.enqueue(std::move(task));
+        }
+    }
+    auto start = Clock::now();
+    pool.resume();
+    waitFor(done, tasks);
+    return elapsedMs(start);
+}
+
+static void benchPrefetch() {
+    const size_t threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 4);
+    const size_t tasks = 50'000;
+    std::cout << tasks << " chase/sum tasks over random 16 KB blocks of 256 MB on " << threads
+              << " threads\n";
+    for (bool hinted : {false, true}) {
+        double ms = runPrefetchMix(hinted, threads, tasks);
+        std::cout << "  " << (hinted ? "prefetch hint: " : "no hint:       ") << ms << " ms ("
+                  << ms * 1e6 / tasks << " ns/task)" << std::endl;
+    }
+}
+
+// --- fibers ---
+// Blocking-style work: a 1 ms sleep, then ten increments under a shared
+// lock. As plain tasks each sleep pins a worker; as fibers the worker moves
+// on, so all 100k can be blocked at once.
+static long maxResidentKb() {
+#if defined(__unix__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+static void benchFibers() {
+    using namespace std::chrono_literals;
+    const size_t threads = 8, tasks = 8'000, fibers = 100'000;
+    std::cout << "1 ms sleep + 10 locked increments each, " << threads << " threads\n";
+    {
+        MB::ThreadPool pool(threads, threads);
+        std::mutex mutex;
+        long counter = 0;
+        std::atomic<size_t> done = 0;
+        auto start = Clock::now();
+        for (size_t i = 0; i < tasks; ++i) {
+            pool.enqueue([&] {
+                std::this_thread::sleep_for(1ms);
+                for (int k = 0; k < 10; ++k) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++counter;
+                }
+                ++done;
+            });
+        }
+        waitFor(done, tasks);
+        double ms = elapsedMs(start);
+        std::cout << "  " << tasks << " plain tasks: " << ms << " ms (" << ms * 1000 / tasks
+                  << " us each)" << std::endl;
+    }
+    {
+        MB::ThreadPool pool(threads, threads);
+        // 100k guarded stacks would need 200k mappings, past vm.max_map_count
+        MB::FiberOptions options;
+        options.guardPage = false;
+        MB::FiberScheduler scheduler(pool, options);
+        MB::FiberMutex mutex;
+        MB::FiberConditionVariable gate;
+        bool open = false;
+        long counter = 0;
+        std::atomic<size_t> parked = 0;
+        long rssBefore = maxResidentKb();
+        // Every fiber waits at the gate first, so all of them are alive at once
+        for (size_t i = 0; i < fibers; ++i) {
+            scheduler.spawn([&] {
+                {
+                    std::unique_lock<MB::FiberMutex> lock(mutex);
+                    ++parked;
+                    gate.wait(lock, [&] { return open; });
+                }
+                MB::this_fiber::sleep_for(1ms);
+                for (int k = 0; k < 10; ++k) {
+                    std::lock_guard<MB::FiberMutex> lock(mutex);
+                    ++counter;
+                }
+            });
+        }
+        waitFor(parked, fibers);
+        size_t live = scheduler.getLiveFiberCount();
+        auto start = Clock::now();
+        {
+            std::unique_lock<MB::FiberMutex> lock(mutex);
+            open = true;
+        }
+        gate.notify_all();
+        scheduler.wait();
+        double ms = elapsedMs(start);
+        std::cout << "  " << fibers << " fibers:     " << ms << " ms (" << ms * 1000 / fibers
+                  << " us each), " << live << " blocked at once, peak RSS +"
+                  << (maxResidentKb() - rssBefore) / 1024 << " MB" << std::endl;
+    }
+}
+
+// --- time slicing ---
+// Heavy tasks (main.cpp's harmonic loop) fill every worker while short
+// tasks arrive every millisecond. As plain tasks the heavy ones run to
+// completion; on fibers they call this_task::yield_if_needed() and give
+// way once per time slice.
+static void runSlicedMix(bool sliced, size_t threads) {
+    using namespace std::chrono_literals;
+    const size_t heavyTasks = threads * 2, terms = 200'000'000, shortTasks = 200;
+    MB::ThreadPool pool(threads, threads);
+    MB::FiberScheduler fibers(pool);
+    std::atomic<size_t> heavyDone = 0, shortDone = 0;
+
+    auto start = Clock::now();
+    std::vector<double> heavyMs(heavyTasks);
+    for (size_t i = 0; i < heavyTasks; ++i) {
+        auto heavy = [&, i] {
+            volatile double result = 0.0;
+            for (size_t j = 0; j < terms; ++j) {
+                result += 3.14159 / double(j + 1);
+                if (j % 4096 == 0) {
+                    MB::this_task::yield_if_needed();
+                }
+            }
+            heavyMs[i] = elapsedMs(start);
+            ++heavyDone;
+        };
+        if (sliced) {
+            fibers.spawn(heavy);
+        } else {
+            pool.enqueue(heavy);
+        }
+    }
+
+    std::vector<double> latency(shortTasks);
+    for (size_t i = 0; i < shortTasks; ++i) {
+        auto submitted = Clock::now();
+        pool.enqueue([&, i, submitted] {
+            latency[i] = elapsedMs(submitted);
+            ++shortDone;
+        });
+        std::this_thread::sleep_for(1ms);
+    }
+    waitFor(shortDone, shortTasks);
+    waitFor(heavyDone, heavyTasks);
+    fibers.wait();
+
+    LatencySummary shorts = summarize(latency);
+    std::cout << "  " << (sliced ? "time-sliced fibers: " : "plain tasks:        ")
+              << "short task wait mean " << shorts.meanMs << " ms, p99 " << shorts.p99Ms
+              << " ms | heavy tasks done in "
+              << *std::max_element(heavyMs.begin(), heavyMs.end()) << " ms" << std::endl;
+}
+
+static void benchSlicing() {
+    const size_t threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 4);
+    std::cout << threads * 2 << " heavy tasks + 200 short ones (1 per ms) on " << threads
+              << " threads, 2 ms slices\n";
+    for (bool sliced : {false, true}) {
+        runSlicedMix(sliced, threads);
+    }
+}
+
+// --- parallel region ---
+// Many short data-parallel phases over one array: a round of enqueue and
+// wait per phase, vs one persistent region with a barrier between phases.
+static void scaleSlice(std::vector<double>& data, size_t tid, size_t parts) {
+    size_t per = data.size() / parts;
+    for (size_t i = tid * per; i < (tid + 1) * per; ++i) {
+        data[i] = data[i] * 0.5 + 1.0;
+    }
+}
+
+static void benchParallelRegion() {
+    const size_t threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 4);
+    const size_t phases = 10'000;
+    std::vector<double> data(threads * 2048, 1.0);
+    std::cout << phases << " phases over " << data.size() << " doubles on " << threads
+              << " threads\n";
+
+    MB::ThreadPool pool(threads, threads);
+    std::atomic<size_t> done = 0;
+    auto start = Clock::now();
+    for (size_t phase = 0; phase < phases; ++phase) {
+        for (size_t tid = 0; tid < threads; ++tid) {
+            pool.enqueue([&, tid] {
+                scaleSlice(data, tid, threads);
+                ++done;
+            });
+        }
+        waitFor(done, (phase + 1) * threads);
+    }
+    double perPhase = elapsedMs(start) * 1000 / phases;
+    std::cout << "  enqueue + wait per phase: " << perPhase << " us/phase" << std::endl;
+
+    start = Clock::now();
+    pool.parallelRegion(threads, [&](size_t tid, MB::Barrier& barrier) {
+        for (size_t phase = 0; phase < phases; ++phase) {
+            scaleSlice(data, tid, barrier.participants());
+            barrier.wait();
+        }
+    });
+    double regionPerPhase = elapsedMs(start) * 1000 / phases;
+    std::cout << "  parallelRegion:           " << regionPerPhase << " us/phase ("
+              << perPhase / regionPerPhase << "x)" << std::endl;
+}
+
+struct Scenario {
+    const char* name;
+    const char* description;
+    void (*run)();
+};
+
+static const Scenario scenarios[] = {
+    {"pingpong", "task chains that each enqueue one follow-up", benchPingPong},
+    {"spawn", "binary tree of tasks spawned from inside the pool", benchSpawn},
+    {"wakeups", "bursty producer; kernel wakeups per task", benchWakeups},
+    {"masswake", "bulk enqueue and shutdown with 256 idle workers", benchMassWakeup},
+    {"shrink", "enqueue right after shrinking an idle pool; lost wakeups", benchShrinkWakeup},
+    {"tenants", "light tenant latency behind a flooding tenant", benchTenants},
+    {"ratelimit", "token-bucket task class with a runtime rate change", benchRateLimit},
+    {"batch", "1 us tasks with and without batched dequeue, 8-64 threads", benchBatch},
+    {"combining", "16-32 producers on mutex, flat-combining and lock-free queues", benchCombining},
+    {"percpu", "16-32 producers on mutex and per-CPU (rseq) queues", benchPerCpu},
+    {"segmented", "unbounded lock-free segmented queue vs std::queue + mutex", benchSegmented},
+    {"typed", "same-function calls via std::function vs TypedPool", benchTyped},
+    {"vector", "harmonic sums run one per task vs four per SIMD batch", benchVector},
+    {"sejf", "mixed short/long jobs, FIFO vs shortest expected first", benchCostModel},
+    {"singleflight", "duplicate requests via enqueue vs enqueueOnce", benchSingleFlight},
+    {"affinity", "shard updates scattered vs routed by affinity key", benchAffinity},
+    {"prefetch", "cold-data tasks with and without a prefetch hint", benchPrefetch},
+    {"fibers", "blocking sleep/lock tasks as plain tasks vs 100k fibers", benchFibers},
+    {"slicing", "short-task wait behind heavy tasks, with and without time slicing", benchSlicing},
+    {"region", "short parallel phases via enqueue/wait vs a parallelRegion barrier", benchParallelRegion},
+};
+
+int main(int argc, char** argv) {
+    for (const Scenario& s : scenarios) {
+        if (argc > 1 && (std::strcmp(argv[1], s.name) == 0 || std::strcmp(argv[1], "all") == 0)) {
+            s.run();
+        }
+    }
+    if (argc < 2) {
+        std::cout << "Usage: main_bench <scenario|all>\n";
+        for (const Scenario& s : scenarios) {
+            std::cout << "  " << s.name << " - " << s.description << "\n";
+        }
+    }
+    return 0;
+}
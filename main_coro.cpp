@@ -0,0 +1,200 @@
+#include "AsyncSync.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+// Benchmarks for the coroutine primitives in AsyncSync.h. Built as C++20,
+// separately from main_bench, since the pool itself is C++17.
+// Run `main_coro <scenario>`; without an argument every scenario is listed.
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void waitFor(const std::atomic<size_t>& counter, size_t target) {
+    while (counter.load() < target) {
+        std::this_thread::yield();
+    }
+}
+
+static size_t benchThreads() {
+    return std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 4);
+}
+
+// --- mutex ---
+// One counter behind a lock, hammered by 64 workers at once: as tasks
+// holding a std::mutex, and as coroutines holding an async_mutex.
+static MB::detached_task lockedIncrements(MB::ThreadPool& pool, MB::async_mutex& mutex,
+                                          long& counter, size_t rounds, std::atomic<size_t>& done) {
+    co_await MB::schedule_on(pool);
+    for (size_t i = 0; i < rounds; ++i) {
+        MB::async_mutex_lock lock = co_await mutex.scoped_lock();
+        ++counter;
+    }
+    ++done;
+}
+
+static void benchMutex() {
+    const size_t threads = benchThreads(), workers = 64, rounds = 20'000;
+    std::cout << workers << " x " << rounds << " locked increments on " << threads << " threads\n";
+    {
+        MB::ThreadPool pool(threads, threads);
+        std::mutex mutex;
+        long counter = 0;
+        std::atomic<size_t> done = 0;
+        auto start = Clock::now();
+        for (size_t w = 0; w < workers; ++w) {
+            pool.enqueue([&] {
+                for (size_t i = 0; i < rounds; ++i) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++counter;
+                }
+                ++done;
+            });
+        }
+        waitFor(done, workers);
+        double ms = elapsedMs(start);
+        std::cout << "  std::mutex in tasks:        " << ms << " ms ("
+                  << ms * 1e6 / (workers * rounds) << " ns/op), counter " << counter << std::endl;
+    }
+    {
+        MB::ThreadPool pool(threads, threads);
+        MB::async_mutex mutex(pool);
+        long counter = 0;
+        std::atomic<size_t> done = 0;
+        auto start = Clock::now();
+        for (size_t w = 0; w < workers; ++w) {
+            lockedIncrements(pool, mutex, counter, rounds, done);
+        }
+        waitFor(done, workers);
+        double ms = elapsedMs(start);
+        std::cout << "  async_mutex in coroutines:  " << ms << " ms ("
+                  << ms * 1e6 / (workers * rounds) << " ns/op), counter " << counter << std::endl;
+    }
+}
+
+// --- semaphore ---
+// 10k coroutines through an 8-permit semaphore, each giving up its worker
+// once while holding a permit
+static MB::detached_task limited(MB::ThreadPool& pool, MB::async_semaphore& permits,
+                                 std::atomic<size_t>& inside, std::atomic<size_t>& peak,
+                                 std::atomic<size_t>& done) {
+    co_await MB::schedule_on(pool);
+    co_await permits.acquire();
+    size_t now = ++inside;
+    size_t seen = peak.load();
+    while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+    }
+    co_await MB::schedule_on(pool);
+    --inside;
+    permits.release();
+    ++done;
+}
+
+static void benchSemaphore() {
+    const size_t threads = benchThreads(), coroutines = 10'000, limit = 8;
+    MB::ThreadPool pool(threads, threads);
+    MB::async_semaphore permits(pool, limit);
+    std::atomic<size_t> inside = 0, peak = 0, done = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < coroutines; ++i) {
+        limited(pool, permits, inside, peak, done);
+    }
+    waitFor(done, coroutines);
+    double ms = elapsedMs(start);
+    std::cout << coroutines << " coroutines through " << limit << " permits on " << threads
+              << " threads: " << ms << " ms, at most " << peak << " inside at once" << std::endl;
+}
+
+// --- latch ---
+// 10k coroutines wait on one latch that 10k tasks count down
+static MB::detached_task awaitLatch(MB::ThreadPool& pool, MB::async_latch& latch,
+                                    std::atomic<size_t>& done) {
+    co_await MB::schedule_on(pool);
+    co_await latch.wait();
+    ++done;
+}
+
+static void benchLatch() {
+    const size_t threads = benchThreads(), waiters = 10'000, arrivals = 10'000;
+    MB::ThreadPool pool(threads, threads);
+    MB::async_latch latch(pool, arrivals);
+    std::atomic<size_t> done = 0, counted = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < waiters; ++i) {
+        awaitLatch(pool, latch, done);
+    }
+    for (size_t i = 0; i < arrivals; ++i) {
+        pool.enqueue([&latch, &counted] {
+            latch.count_down();
+            ++counted;
+        });
+    }
+    waitFor(done, waiters);
+    waitFor(counted, arrivals); // The last count_down may still be resuming waiters
+    std::cout << waiters << " waiters released by " << arrivals << " count-downs on " << threads
+              << " threads: " << elapsedMs(start) << " ms" << std::endl;
+}
+
+// --- barrier ---
+// One coroutine per worker going through many short phases
+static MB::detached_task phases(MB::ThreadPool& pool, MB::async_barrier& barrier, size_t count,
+                                std::atomic<size_t>& work, std::atomic<size_t>& done) {
+    co_await MB::schedule_on(pool);
+    for (size_t phase = 0; phase < count; ++phase) {
+        ++work;
+        co_await barrier.arrive_and_wait();
+    }
+    ++done;
+}
+
+static void benchBarrier() {
+    const size_t threads = benchThreads(), participants = threads, count = 20'000;
+    MB::ThreadPool pool(threads, threads);
+    MB::async_barrier barrier(pool, participants);
+    std::atomic<size_t> work = 0, done = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < participants; ++i) {
+        phases(pool, barrier, count, work, done);
+    }
+    waitFor(done, participants);
+    double ms = elapsedMs(start);
+    std::cout << participants << " coroutines x " << count << " barrier phases on " << threads
+              << " threads: " << ms << " ms (" << ms * 1000 / count << " us/phase), "
+              << work << " steps" << std::endl;
+}
+
+struct Scenario {
+    const char* name;
+    const char* description;
+    void (*run)();
+};
+
+static const Scenario scenarios[] = {
+    {"mutex", "contended counter: std::mutex in tasks vs async_mutex in coroutines", benchMutex},
+    {"semaphore", "10k coroutines through an 8-permit async_semaphore", benchSemaphore},
+    {"latch", "10k coroutines released by one async_latch", benchLatch},
+    {"barrier", "short phases separated by an async_barrier", benchBarrier},
+};
+
+int main(int argc, char** argv) {
+    for (const Scenario& s : scenarios) {
+        if (argc > 1 && (std::strcmp(argv[1], s.name) == 0 || std::strcmp(argv[1], "all") == 0)) {
+            s.run();
+        }
+    }
+    if (argc < 2) {
+        std::cout << "Usage: main_coro <scenario|all>\n";
+        for (const Scenario& s : scenarios) {
+            std::cout << "  " << s.name << " - " << s.description << "\n";
+        }
+    }
+    return 0;
+}